@@ -0,0 +1,83 @@
+// Shared setup for the headless text layer benchmarks. Include once per executable, from the file with main()
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+#define XHL_ALLOC_IMPL
+#define XHL_FILES_IMPL
+#define XHL_TIME_IMPL
+
+#include "common.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <xhl/alloc.h>
+#include <xhl/files.h>
+#include <xhl/time.h>
+
+#include <sokol_gfx.h>
+
+#ifndef SOKOL_DUMMY_BACKEND
+#error Benchmarks must be built with SOKOL_DUMMY_BACKEND
+#endif
+
+#define BENCH_ASSET_PATH(name) SRC_DIR XFILES_DIR_STR "assets" XFILES_DIR_STR name
+
+enum
+{
+    BENCH_GUI_WIDTH  = GUI_INIT_WIDTH,
+    BENCH_GUI_HEIGHT = GUI_INIT_HEIGHT,
+};
+
+#ifndef NDEBUG
+void println(const char* const fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+#endif
+
+static _sg_state_t* bench_setup()
+{
+    xtime_init();
+    xalloc_init();
+
+    _sg_state_t* sg = sg_setup(&(sg_desc){
+        .environment.defaults = {
+            .color_format = SG_PIXELFORMAT_RGBA8,
+            .depth_format = SG_PIXELFORMAT_NONE,
+            .sample_count = 1,
+        }});
+    xassert(sg);
+    sg_set_global(sg);
+    return sg;
+}
+
+static void bench_shutdown(_sg_state_t* sg)
+{
+    sg_shutdown(sg);
+    sg_set_global(NULL);
+    xalloc_shutdown();
+}
+
+static void bench_begin_frame()
+{
+    sg_begin_pass(&(sg_pass){
+        .swapchain = {
+            .width        = BENCH_GUI_WIDTH,
+            .height       = BENCH_GUI_HEIGHT,
+            .sample_count = 1,
+            .color_format = SG_PIXELFORMAT_RGBA8,
+            .depth_format = SG_PIXELFORMAT_NONE,
+        }});
+}
+
+static void bench_end_frame()
+{
+    sg_end_pass();
+    sg_commit();
+}
+
+#endif // BENCH_COMMON_H
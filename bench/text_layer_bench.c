@@ -0,0 +1,1322 @@
+// Headless benchmark suite for the text layer. Runs against sokol's dummy backend, so it needs no window or GPU.
+//
+// The stages suite runs every corpus with every font, timing each stage of the pipeline separately:
+//   shape   - kbts shaping + layout of the corpus (shape_text)
+//   raster  - cold get_glyph_rect, which rasters and packs every glyph that isn't cached yet
+//   pack    - replaying the same rect sizes through a fresh atlas packer, one rect at a time
+//   lookup  - warm get_glyph_rect
+//   emit    - warm draw_glyph (lookup + quad emission)
+//   frame   - text_layer_draw_text + text_layer_draw with the shape cache
+// Timings are ns per glyph. Heap allocations made through the xhl allocators are counted for the cold pass and for
+// each warm frame.
+//
+// Most scenarios draw a plugin UI built from the same labels for many frames, and compare text layer features against
+// each other with the first font. --list prints them.
+//
+// Usage: text_layer_bench [--json] [--quick] [--font path/to/font.ttf]... [--run name]...
+// --json prints one JSON object per line instead of a table, for regression tracking.
+// --quick runs every scenario for a few frames only, to check they still work.
+// --font adds a font to the run. The bundled fonts have no CJK glyphs, so pass a CJK font to get meaningful raster
+// numbers for the CJK corpus.
+// --run runs the stages suite ("stages") or a scenario instead of everything.
+#include "bench_common.h"
+
+#include <string.h>
+
+// Count every allocation the text layer makes. The implementation is compiled into this file so the bench can time
+// its internal stages
+static uint64_t g_num_allocs = 0;
+static void*    bench_malloc(size_t sz) { return g_num_allocs++, xmalloc(sz); }
+static void*    bench_calloc(size_t n, size_t sz) { return g_num_allocs++, xcalloc(n, sz); }
+static void*    bench_realloc(void* ptr, size_t sz) { return g_num_allocs++, xrealloc(ptr, sz); }
+#undef xmalloc
+#undef xcalloc
+#undef xrealloc
+#define xmalloc(sz)       bench_malloc(sz)
+#define xcalloc(n, sz)    bench_calloc(n, sz)
+#define xrealloc(ptr, sz) bench_realloc(ptr, sz)
+
+#define TEXT_IMPL
+#include "text_rendering_layer.h"
+
+enum
+{
+    FONT_SIZE    = 12,
+    NUM_REPEATS  = 200,
+    NUM_READOUTS = 8,
+    MAX_FONTS    = 8,
+    MAX_RUNS     = 16,
+    MAX_METRICS  = 8,
+    // Frame and repeat counts are capped to this with --quick
+    QUICK_COUNT = 3,
+};
+
+static bool g_json  = false;
+static bool g_quick = false;
+
+static int bench_count(int n) { return g_quick && n > QUICK_COUNT ? QUICK_COUNT : n; }
+
+// Every benchmark draws these. A typical plugin UI: parameter names plus a few static readouts
+static const char* LABELS[] = {
+    "Input", "Output", "Drive", "Tone", "Mix", "Attack", "Release", "Threshold",
+    "Ratio", "Knee", "Makeup", "Lookahead", "Bypass", "Oversample", "Stereo Link", "Sidechain",
+    "Low Cut", "High Cut", "Low Shelf", "High Shelf", "Frequency", "Gain", "Presets", "Settings",
+    "-12.50dB", "440.0Hz", "1:4.0", "100%", "0.75 ms", "A/B", "Undo", "About",
+};
+
+// The labels joined with spaces, for the stages suite. Filled in by main()
+static char g_labels_text[512];
+
+// Meter or parameter readouts that change every frame
+static void format_readout(char* buf, size_t buf_size, int frame, int i)
+{
+    snprintf(buf, buf_size, "%.2fdB", -48.0f + ((frame * 7 + i * 13) % 600) * 0.1f);
+}
+
+// Draws the labels in rows of 4, columns column_width apart
+static void draw_labels(TextLayer* tl, float x, float y, float font_size, float column_width, float row_height)
+{
+    for (int i = 0; i < ARRLEN(LABELS); i++)
+        text_layer_draw_text(
+            tl,
+            (text_layer_font){0},
+            LABELS[i],
+            NULL,
+            x + (i & 3) * column_width,
+            y + (i >> 2) * row_height,
+            font_size);
+}
+
+
+typedef struct corpus
+{
+    const char* name;
+    const char* text;
+    // Text changes every frame, like a meter or parameter readout
+    bool changing;
+} corpus;
+
+static const corpus CORPORA[] = {
+    {
+        "ascii_labels",
+        g_labels_text,
+    },
+    {
+        // MY_TEXT from gui.c
+        "mixed_script",
+        "Приве́т नमस्ते שָׁלוֹם  wow 🐨",
+    },
+    {
+        "cjk_paragraph",
+        "晋太元中，武陵人捕鱼为业。缘溪行，忘路之远近。忽逢桃花林，夹岸数百步，中无杂树，芳草鲜美，落英缤纷。"
+        "渔人甚异之，复前行，欲穷其林。林尽水源，便得一山，山有小口，仿佛若有光。便舍船，从口入。初极狭，才通人。"
+        "复行数十步，豁然开朗。土地平旷，屋舍俨然，有良田美池桑竹之属。阡陌交通，鸡犬相闻。",
+    },
+    {
+        "numeric_readouts",
+        "-48.37dB +10.00dB 440.0Hz 12.5kHz 0.25ms 100% -inf 3.14:1",
+        .changing = true,
+    },
+};
+
+typedef struct result
+{
+    int num_glyphs;     // Glyphs in the shaped corpus
+    int num_rasterized; // Unique glyphs cached in the atlas
+
+    double shape_ns, raster_ns, pack_ns, lookup_ns, emit_ns, frame_ns; // Per glyph
+
+    uint64_t cold_allocs;  // Allocations while shaping and rastering the corpus the first time
+    uint64_t frame_allocs; // Allocations per frame once warm
+
+    int    atlas_pages;
+    double atlas_fill; // Fraction of atlas pixels covered by glyph rects, including padding
+} result;
+
+static void format_readouts(char* buf, size_t buf_size, int frame)
+{
+    int len = 0;
+    for (int i = 0; i < NUM_READOUTS && len < buf_size; i++)
+    {
+        char readout[32];
+        format_readout(readout, sizeof(readout), frame, i);
+        len += snprintf(buf + len, buf_size - len, "%s ", readout);
+    }
+}
+
+static void run_stages(const char* font_path, const corpus* c, result* res)
+{
+    memset(res, 0, sizeof(*res));
+    const int num_repeats = bench_count(NUM_REPEATS);
+
+    TextLayer* gui = text_layer_new(&(text_layer_desc){.font_path = font_path});
+
+    shaped_run run = {
+        .text      = (char*)c->text,
+        .text_len  = strlen(c->text),
+        .font_size = FONT_SIZE,
+        .direction = KBTS_DIRECTION_DONT_KNOW,
+        .language  = KBTS_LANGUAGE_DONT_KNOW,
+    };
+
+    // Cold shape + raster
+    uint64_t allocs_start = g_num_allocs;
+    shape_text(gui, &run);
+    const int num_glyphs = xarr_len(run.glyphs);
+    res->num_glyphs      = num_glyphs;
+
+    uint64_t t0 = xtime_now_ns();
+    for (int i = 0; i < num_glyphs; i++)
+        get_glyph_rect(gui, 0, run.glyphs[i].id, FONT_SIZE, 0);
+    uint64_t t1         = xtime_now_ns();
+    res->cold_allocs    = g_num_allocs - allocs_start;
+    res->num_rasterized = xarr_len(gui->rects);
+    res->raster_ns      = (double)(t1 - t0) / (res->num_rasterized ? res->num_rasterized : 1);
+
+    // Shape
+    t0 = xtime_now_ns();
+    for (int r = 0; r < num_repeats; r++)
+        shape_text(gui, &run);
+    t1            = xtime_now_ns();
+    res->shape_ns = (double)(t1 - t0) / (num_repeats * num_glyphs);
+
+    // Pack. Replays the rects in the order they were rastered, into pages of the default maximum size
+    {
+        const int    size = ATLAS_DEFAULT_MAX_SIZE;
+        atlas_packer packer;
+        atlas_packer_init(&packer, gui->current_atlases[ATLAS_CLASS_SMALL].packer.kind);
+        uint64_t pack_total_ns = 0;
+        for (int r = 0; r < num_repeats; r++)
+        {
+            atlas_packer_reset(&packer, size - RECTPACK_PADDING, size - RECTPACK_PADDING);
+            t0 = xtime_now_ns();
+            for (int i = 0; i < res->num_rasterized; i++)
+            {
+                stbrp_rect rect = {.w = gui->rects[i].w + RECTPACK_PADDING, .h = gui->rects[i].h + RECTPACK_PADDING};
+                if (!atlas_packer_pack(&packer, &rect, 1))
+                    atlas_packer_reset(&packer, size - RECTPACK_PADDING, size - RECTPACK_PADDING);
+            }
+            pack_total_ns += xtime_now_ns() - t0;
+        }
+        atlas_packer_free(&packer);
+        res->pack_ns = res->num_rasterized ? (double)pack_total_ns / (num_repeats * res->num_rasterized) : 0;
+    }
+
+    // Lookup
+    t0 = xtime_now_ns();
+    for (int r = 0; r < num_repeats; r++)
+        for (int i = 0; i < num_glyphs; i++)
+            get_glyph_rect(gui, 0, run.glyphs[i].id, FONT_SIZE, 0);
+    t1             = xtime_now_ns();
+    res->lookup_ns = (double)(t1 - t0) / (num_repeats * num_glyphs);
+
+    // Emit
+    t0 = xtime_now_ns();
+    for (int r = 0; r < num_repeats; r++)
+    {
+        xarr_setlen(gui->text_buffer, 0);
+        for (int i = 0; i < num_glyphs; i++)
+            draw_glyph(gui, 0, (10 << 6) + run.glyphs[i].x, 10 + run.glyphs[i].y, run.glyphs[i].id, FONT_SIZE);
+    }
+    t1           = xtime_now_ns();
+    res->emit_ns = (double)(t1 - t0) / (num_repeats * num_glyphs);
+    xarr_setlen(gui->text_buffer, 0);
+
+    // Full frames. The first one warms the shape cache
+    char     readouts[256];
+    uint64_t frame_ns = 0;
+    allocs_start      = g_num_allocs;
+    for (int frame = 0; frame <= num_repeats; frame++)
+    {
+        const char* text = c->text;
+        if (c->changing)
+        {
+            format_readouts(readouts, sizeof(readouts), frame);
+            text = readouts;
+        }
+        if (frame == 1)
+            allocs_start = g_num_allocs;
+
+        bench_begin_frame();
+        t0 = xtime_now_ns();
+        text_layer_draw_text(gui, (text_layer_font){0}, text, NULL, 10, 10, FONT_SIZE);
+        text_layer_draw(gui, (sg_sampler){0}, BENCH_GUI_WIDTH, BENCH_GUI_HEIGHT);
+        t1 = xtime_now_ns();
+        bench_end_frame();
+
+        if (frame > 0)
+            frame_ns += t1 - t0;
+    }
+    res->frame_ns     = (double)frame_ns / (num_repeats * num_glyphs);
+    res->frame_allocs = (g_num_allocs - allocs_start) / num_repeats;
+
+    // Atlas fill
+    uint64_t covered = 0;
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+        if (gui->rects[i].atlas_idx >= 0)
+            covered += (gui->rects[i].w + RECTPACK_PADDING) * (gui->rects[i].h + RECTPACK_PADDING);
+    text_layer_stats stats;
+    text_layer_get_stats(gui, &stats);
+    res->atlas_pages = stats.atlas_pages;
+    res->atlas_fill  = (double)covered / (stats.atlas_bytes / gui->atlas_channels);
+
+    xarr_free(run.glyphs);
+    text_layer_destroy(gui);
+}
+
+static const char* file_name(const char* path)
+{
+    const char* name = path;
+    for (const char* c = path; *c; c++)
+        if (*c == '/' || *c == '\\')
+            name = c + 1;
+    return name;
+}
+
+static void stages_suite(const char** fonts, int num_fonts)
+{
+    if (!g_json)
+    {
+        printf(
+            "%-28s %-17s %6s %6s | %8s %8s %8s %8s %8s %8s | %7s %7s | %5s %6s\n",
+            "font",
+            "corpus",
+            "glyphs",
+            "raster",
+            "shape",
+            "raster",
+            "pack",
+            "lookup",
+            "emit",
+            "frame",
+            "allocs",
+            "/frame",
+            "pages",
+            "fill");
+    }
+
+    for (int f = 0; f < num_fonts; f++)
+    {
+        for (int c = 0; c < ARRLEN(CORPORA); c++)
+        {
+            result res;
+            run_stages(fonts[f], CORPORA + c, &res);
+
+            if (g_json)
+            {
+                printf(
+                    "{\"font\":\"%s\",\"corpus\":\"%s\",\"glyphs\":%d,\"rasterized\":%d,"
+                    "\"shape_ns\":%.2f,\"raster_ns\":%.2f,\"pack_ns\":%.2f,\"lookup_ns\":%.2f,\"emit_ns\":%.2f,"
+                    "\"frame_ns\":%.2f,\"cold_allocs\":%llu,\"frame_allocs\":%llu,\"atlas_pages\":%d,"
+                    "\"atlas_fill\":%.4f}\n",
+                    file_name(fonts[f]),
+                    CORPORA[c].name,
+                    res.num_glyphs,
+                    res.num_rasterized,
+                    res.shape_ns,
+                    res.raster_ns,
+                    res.pack_ns,
+                    res.lookup_ns,
+                    res.emit_ns,
+                    res.frame_ns,
+                    (unsigned long long)res.cold_allocs,
+                    (unsigned long long)res.frame_allocs,
+                    res.atlas_pages,
+                    res.atlas_fill);
+            }
+            else
+            {
+                printf(
+                    "%-28s %-17s %6d %6d | %8.1f %8.1f %8.1f %8.1f %8.1f %8.1f | %7llu %7llu | %5d %5.1f%%\n",
+                    file_name(fonts[f]),
+                    CORPORA[c].name,
+                    res.num_glyphs,
+                    res.num_rasterized,
+                    res.shape_ns,
+                    res.raster_ns,
+                    res.pack_ns,
+                    res.lookup_ns,
+                    res.emit_ns,
+                    res.frame_ns,
+                    (unsigned long long)res.cold_allocs,
+                    (unsigned long long)res.frame_allocs,
+                    res.atlas_pages,
+                    res.atlas_fill * 100);
+            }
+        }
+    }
+    if (!g_json)
+        printf("Timings in ns per glyph\n");
+}
+
+// One row of scenario output. Metrics are printed in the order they were added
+typedef struct report
+{
+    const char* scenario;
+    const char* variant;
+    int         num_metrics;
+    struct
+    {
+        const char* name;
+        double      value;
+    } metrics[MAX_METRICS];
+} report;
+
+static void report_add(report* r, const char* name, double value)
+{
+    xassert(r->num_metrics < MAX_METRICS);
+    r->metrics[r->num_metrics].name  = name;
+    r->metrics[r->num_metrics].value = value;
+    r->num_metrics++;
+}
+
+static void report_print(const report* r)
+{
+    if (g_json)
+    {
+        printf("{\"scenario\":\"%s\",\"variant\":\"%s\"", r->scenario, r->variant);
+        for (int i = 0; i < r->num_metrics; i++)
+            printf(",\"%s\":%.10g", r->metrics[i].name, r->metrics[i].value);
+        printf("}\n");
+        return;
+    }
+
+    printf("%-14s %-22s", r->scenario, r->variant);
+    for (int i = 0; i < r->num_metrics; i++)
+    {
+        const double value = r->metrics[i].value;
+        if (value == (int64_t)value)
+            printf(" | %s %lld", r->metrics[i].name, (long long)value);
+        else
+            printf(" | %s %.2f", r->metrics[i].name, value);
+    }
+    printf("\n");
+}
+
+// Atlas size and how much of it holds glyphs
+static void report_atlas(report* r, const text_layer_stats* stats)
+{
+    report_add(r, "pages", stats->atlas_pages);
+    report_add(r, "atlas_mb", stats->atlas_bytes / (1024.0 * 1024.0));
+    report_add(r, "occupancy_pct", 100.0 * stats->atlas_glyph_bytes / stats->atlas_bytes);
+}
+
+// A scenario's TextLayer. The variant's desc is used as is, apart from the font
+static TextLayer* new_layer(const char* font_path, text_layer_desc desc)
+{
+    desc.font_path = font_path;
+    return text_layer_new(&desc);
+}
+
+typedef void (*draw_frame_fn)(TextLayer* tl, int frame);
+
+typedef struct frame_times
+{
+    uint64_t first_ns;          // The first frame, which rasters most glyphs
+    uint64_t first_rasterized;  // Glyphs rastered by the first frame
+    int      num_warm_frames;   // Every later frame
+    uint64_t warm_ns;           // text_layer_draw_text calls and text_layer_draw
+    uint64_t warm_text_ns;      // text_layer_draw_text calls
+    uint64_t warm_submit_ns;    // text_layer_draw
+    uint64_t warm_draw_calls;
+} frame_times;
+
+static void run_frames(TextLayer* tl, int num_frames, draw_frame_fn draw_frame, frame_times* times)
+{
+    memset(times, 0, sizeof(*times));
+    for (int frame = 0; frame < num_frames; frame++)
+    {
+        bench_begin_frame();
+        uint64_t t0 = xtime_now_ns();
+        draw_frame(tl, frame);
+        uint64_t t1 = xtime_now_ns();
+        text_layer_draw(tl, (sg_sampler){0}, BENCH_GUI_WIDTH, BENCH_GUI_HEIGHT);
+        uint64_t t2 = xtime_now_ns();
+        bench_end_frame();
+
+        text_layer_stats stats;
+        text_layer_get_stats(tl, &stats);
+        if (frame == 0)
+        {
+            times->first_ns         = t2 - t0;
+            times->first_rasterized = stats.total.glyphs_rasterized;
+        }
+        else
+        {
+            times->num_warm_frames++;
+            times->warm_ns         += t2 - t0;
+            times->warm_text_ns    += t1 - t0;
+            times->warm_submit_ns  += t2 - t1;
+            times->warm_draw_calls += stats.last_frame.draw_calls;
+        }
+    }
+}
+
+// Mean over the warm frames, in microseconds
+static double warm_us(const frame_times* times, uint64_t ns)
+{
+    return times->num_warm_frames ? ns * 1e-3 / times->num_warm_frames : 0;
+}
+
+typedef struct variant
+{
+    const char*     name;
+    text_layer_desc desc;
+} variant;
+
+// Adds a scenario's metrics for one variant, once its frames are drawn
+typedef void (*add_metrics_fn)(TextLayer* tl, const frame_times* times, report* r);
+
+// Draws the same frames with a TextLayer per variant
+static void run_variants(
+    const char*    scenario,
+    const char*    font_path,
+    const variant* variants,
+    int            num_variants,
+    int            num_frames,
+    draw_frame_fn  draw_frame,
+    add_metrics_fn add_metrics)
+{
+    for (int v = 0; v < num_variants; v++)
+    {
+        TextLayer*  tl = new_layer(font_path, variants[v].desc);
+        frame_times times;
+        run_frames(tl, num_frames, draw_frame, &times);
+
+        report r = {scenario, variants[v].name};
+        add_metrics(tl, &times, &r);
+        report_print(&r);
+
+        text_layer_destroy(tl);
+    }
+}
+
+// glyph_map: the glyph cache lookup in get_glyph_rect(), through the hash map against the linear scan over the rects
+// array it replaced. Keys resemble a CJK heavy UI: a large range of glyph ids at a handful of sizes
+enum
+{
+    GLYPH_MAP_NUM_LOOKUPS = 1 << 22,
+    // The linear scan gets very slow with large caches. Cap its work so the scenario finishes
+    GLYPH_MAP_MAX_LINEAR_WORK = 1 << 28,
+};
+
+// Keeps the compiler from dropping the lookups
+static volatile uint64_t g_glyph_map_checksum;
+
+static uint32_t g_rng_state = 0x9e3779b9;
+static uint32_t rng()
+{
+    g_rng_state ^= g_rng_state << 13;
+    g_rng_state ^= g_rng_state >> 17;
+    g_rng_state ^= g_rng_state << 5;
+    return g_rng_state;
+}
+
+static void run_glyph_map(int num_glyphs, report* r)
+{
+    static const float SIZES[] = {10, 12, 14, 18, 24, 48};
+
+    uint64_t* keys = xmalloc(sizeof(*keys) * num_glyphs);
+    for (int i = 0; i < num_glyphs; i++)
+    {
+        union atlas_rect_header h = {.glyphid = i / ARRLEN(SIZES), .pixel_size = SIZES[i % ARRLEN(SIZES)]};
+        keys[i]                   = h.data;
+    }
+
+    const int num_lookups = bench_count(GLYPH_MAP_NUM_LOOKUPS);
+    uint32_t* lookups     = xmalloc(sizeof(*lookups) * num_lookups);
+    for (int i = 0; i < num_lookups; i++)
+        lookups[i] = rng() % num_glyphs;
+
+    glyph_map map = {0};
+    for (int i = 0; i < num_glyphs; i++)
+        glyph_map_set(&map, keys[i], i);
+
+    uint64_t checksum = 0;
+    uint64_t t0       = xtime_now_ns();
+    for (int i = 0; i < num_lookups; i++)
+        checksum += glyph_map_get(&map, keys[lookups[i]]);
+    uint64_t t1 = xtime_now_ns();
+
+    const double hash_mlps = num_lookups / ((t1 - t0) * 1e-3);
+
+    int num_linear = GLYPH_MAP_MAX_LINEAR_WORK / num_glyphs;
+    if (num_linear > num_lookups)
+        num_linear = num_lookups;
+    t0 = xtime_now_ns();
+    for (int i = 0; i < num_linear; i++)
+    {
+        const uint64_t key = keys[lookups[i]];
+        for (int j = 0; j < num_glyphs; j++)
+        {
+            if (keys[j] == key)
+            {
+                checksum -= j;
+                break;
+            }
+        }
+    }
+    t1 = xtime_now_ns();
+
+    const double linear_mlps = num_linear / ((t1 - t0) * 1e-3);
+
+    // Both loops find the same indices
+    xassert(num_linear < num_lookups || checksum == 0);
+    g_glyph_map_checksum += checksum;
+
+    report_add(r, "hash_mlookups_s", hash_mlps);
+    report_add(r, "linear_mlookups_s", linear_mlps);
+    report_add(r, "speedup", hash_mlps / linear_mlps);
+
+    glyph_map_free(&map);
+    xfree(lookups);
+    xfree(keys);
+}
+
+static void scenario_glyph_map(const char* font_path)
+{
+    static const int NUM_GLYPHS[] = {100, 10000, 100000};
+    for (int i = 0; i < ARRLEN(NUM_GLYPHS); i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%d_glyphs", NUM_GLYPHS[i]);
+        report r = {"glyph_map", name};
+        run_glyph_map(NUM_GLYPHS[i], &r);
+        report_print(&r);
+    }
+}
+
+// shape_cache: static labels plus readouts that change every frame, with and without the shaped run cache
+static void draw_shape_cache_frame(TextLayer* tl, int frame)
+{
+    draw_labels(tl, 10, 10, FONT_SIZE, 120, 20);
+
+    char readout[32];
+    for (int i = 0; i < 4; i++)
+    {
+        format_readout(readout, sizeof(readout), frame, i);
+        text_layer_draw_text(tl, (text_layer_font){0}, readout, NULL, 10 + i * 120, 200, FONT_SIZE);
+    }
+}
+
+static void add_shape_cache_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    const uint64_t lookups = stats.total.shape_cache_hits + stats.total.shape_cache_misses;
+    report_add(r, "draw_text_us", warm_us(times, times->warm_text_ns));
+    report_add(r, "shape_hit_pct", lookups ? 100.0 * stats.total.shape_cache_hits / lookups : 0);
+    report_add(r, "shape_entries", stats.shape_cache_entries);
+}
+
+static void scenario_shape_cache(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"no_cache", {.disable_shape_cache = true}},
+        {"cache", {0}},
+    };
+    run_variants(
+        "shape_cache",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(500),
+        draw_shape_cache_frame,
+        add_shape_cache_metrics);
+}
+
+// glyph_modes: bitmap and distance field glyphs across a zoom sweep. Every frame draws the labels a quarter pixel
+// larger, as an animated zoom or a window resize would. Bitmap glyphs are rastered again at every size, distance
+// fields only once
+enum
+{
+    ZOOM_MIN_FONT_SIZE = 8,
+    ZOOM_MAX_FONT_SIZE = 96,
+    ZOOM_NUM_STEPS     = (ZOOM_MAX_FONT_SIZE - ZOOM_MIN_FONT_SIZE) * 4 + 1,
+};
+
+static void draw_zoom_frame(TextLayer* tl, int frame)
+{
+    const float font_size = ZOOM_MIN_FONT_SIZE + frame * 0.25f;
+    draw_labels(tl, 10, 10, font_size, font_size * 8, font_size * 1.5f);
+}
+
+static void add_glyph_mode_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    // Every frame of the sweep rasters, so the first one counts too
+    report_add(r, "frame_us", (times->first_ns + times->warm_ns) * 1e-3 / (times->num_warm_frames + 1));
+    report_add(r, "raster_ms", stats.total.raster_time * 1e-6);
+    report_add(r, "rastered", stats.total.glyphs_rasterized);
+    report_atlas(r, &stats);
+}
+
+static void scenario_glyph_modes(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"bitmap", {.glyph_mode = TEXT_LAYER_GLYPH_BITMAP}},
+        {"sdf", {.glyph_mode = TEXT_LAYER_GLYPH_SDF}},
+        {"msdf", {.glyph_mode = TEXT_LAYER_GLYPH_MSDF}},
+    };
+    run_variants(
+        "glyph_modes",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(ZOOM_NUM_STEPS),
+        draw_zoom_frame,
+        add_glyph_mode_metrics);
+}
+
+// subpixel: the labels at a handful of small sizes, with 1, 2 and 4 subpixel bins. Each bin a glyph lands in is a
+// separate atlas entry, so the cache takes longer to warm up and holds more glyphs
+static void draw_subpixel_frame(TextLayer* tl, int frame)
+{
+    for (int size = 10; size <= 14; size++)
+        draw_labels(tl, 10, 10 + (size - 10) * 140, size, 120, 16);
+}
+
+static void add_subpixel_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    const uint64_t lookups = stats.total.glyph_cache_hits + stats.total.glyph_cache_misses;
+    report_add(r, "rastered_first", times->first_rasterized);
+    report_add(r, "rastered", stats.total.glyphs_rasterized);
+    report_add(r, "pages", stats.atlas_pages);
+    report_add(r, "hit_pct", 100.0 * stats.total.glyph_cache_hits / lookups);
+    report_add(r, "frame_us", warm_us(times, times->warm_ns));
+}
+
+static void scenario_subpixel(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"1_bin", {.subpixel_bins = 1}},
+        {"2_bins", {.subpixel_bins = 2}},
+        {"4_bins", {.subpixel_bins = 4}},
+    };
+    run_variants(
+        "subpixel",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(200),
+        draw_subpixel_frame,
+        add_subpixel_metrics);
+}
+
+// The first frame of a plugin editor: the labels in a few text styles
+static void draw_editor(TextLayer* tl)
+{
+    static const float SIZES[] = {10, 12, 14, 18, 24};
+    for (int s = 0; s < ARRLEN(SIZES); s++)
+        draw_labels(tl, 10, 10 + s * 180, SIZES[s], 120, SIZES[s] * 1.5f);
+}
+
+// shared_cache: plugin instances opened one after another and kept alive, as in a DAW session with the plugin on many
+// tracks. The first one loads the font and rasters every glyph, the rest copy the glyphs from the process wide cache
+static void scenario_shared_cache(const char* font_path)
+{
+    enum
+    {
+        NUM_INSTANCES = 8,
+    };
+    TextLayer* instances[NUM_INSTANCES];
+    for (int n = 0; n < NUM_INSTANCES; n++)
+    {
+        bench_begin_frame();
+        uint64_t   t0 = xtime_now_ns();
+        TextLayer* tl = new_layer(font_path, (text_layer_desc){0});
+        uint64_t   t1 = xtime_now_ns();
+        draw_editor(tl);
+        text_layer_draw(tl, (sg_sampler){0}, BENCH_GUI_WIDTH, BENCH_GUI_HEIGHT);
+        uint64_t t2 = xtime_now_ns();
+        bench_end_frame();
+
+        text_layer_stats stats;
+        text_layer_get_stats(tl, &stats);
+
+        char name[32];
+        snprintf(name, sizeof(name), "instance_%d", n + 1);
+        report r = {"shared_cache", name};
+        report_add(&r, "open_us", (t1 - t0) * 1e-3);
+        report_add(&r, "first_frame_us", (t2 - t1) * 1e-3);
+        report_add(&r, "rastered", stats.total.glyphs_rasterized);
+        report_add(&r, "shared", stats.total.shared_glyph_hits);
+        report_print(&r);
+
+        instances[n] = tl;
+    }
+
+    for (int n = 0; n < NUM_INSTANCES; n++)
+        text_layer_destroy(instances[n]);
+}
+
+// atlas_cache: opening the editor cold, with an empty atlas, against opening it warm from the atlas cache file written
+// when the previous editor closed. Each open creates the text layer and draws the first frame
+static void scenario_atlas_cache(const char* font_path)
+{
+    static const char* CACHE_PATH = "text_layer_bench_atlas_cache.bin";
+
+    const int num_opens = bench_count(10);
+    for (int warm = 0; warm < 2; warm++)
+    {
+        text_layer_stats stats;
+        uint64_t         total_ns = 0;
+        for (int i = 0; i < num_opens; i++)
+        {
+            if (!warm)
+                remove(CACHE_PATH);
+
+            bench_begin_frame();
+            uint64_t   t0 = xtime_now_ns();
+            TextLayer* tl = new_layer(font_path, (text_layer_desc){.atlas_cache_path = CACHE_PATH});
+            draw_editor(tl);
+            text_layer_draw(tl, (sg_sampler){0}, BENCH_GUI_WIDTH, BENCH_GUI_HEIGHT);
+            total_ns += xtime_now_ns() - t0;
+            bench_end_frame();
+
+            text_layer_get_stats(tl, &stats);
+            // Writes the cache file for the next open
+            text_layer_destroy(tl);
+        }
+
+        report r = {"atlas_cache", warm ? "warm" : "cold"};
+        report_add(&r, "open_us", total_ns * 1e-3 / num_opens);
+        report_add(&r, "rastered", stats.total.glyphs_rasterized);
+        report_add(&r, "uploaded_kb", stats.total.atlas_bytes_uploaded / 1024.0);
+        report_print(&r);
+    }
+    remove(CACHE_PATH);
+}
+
+// prerender: rastering a UI's character set up front with text_layer_prerender() against rastering it lazily, one
+// glyph cache miss at a time, the first time each glyph is drawn
+static void scenario_prerender(const char* font_path)
+{
+    static const float SIZES[] = {10, 11, 12, 13, 14, 16, 18, 20, 24, 28, 32, 40, 48};
+
+    static const text_layer_codepoint_range RANGES[] = {
+        {'!', '~'},       // ASCII
+        {0xb0, 0xb0},     // Degree sign
+        {0x2212, 0x2212}, // Minus sign
+    };
+
+    const int num_runs = bench_count(10);
+    for (int prerender = 0; prerender < 2; prerender++)
+    {
+        text_layer_stats stats;
+        uint64_t         total_ns = 0;
+        for (int i = 0; i < num_runs; i++)
+        {
+            bench_begin_frame();
+            TextLayer* tl = new_layer(font_path, (text_layer_desc){0});
+
+            uint64_t t0 = xtime_now_ns();
+            if (prerender)
+            {
+                text_layer_prerender(tl, (text_layer_font){0}, RANGES, ARRLEN(RANGES), SIZES, ARRLEN(SIZES));
+            }
+            else
+            {
+                char text[8];
+                for (int s = 0; s < ARRLEN(SIZES); s++)
+                {
+                    for (int r = 0; r < ARRLEN(RANGES); r++)
+                    {
+                        for (uint32_t c = RANGES[r].first; c <= RANGES[r].last; c++)
+                        {
+                            // UTF-8 encode one codepoint
+                            int n = 0;
+                            if (c < 0x80)
+                            {
+                                text[n++] = c;
+                            }
+                            else if (c < 0x800)
+                            {
+                                text[n++] = 0xc0 | (c >> 6);
+                                text[n++] = 0x80 | (c & 0x3f);
+                            }
+                            else
+                            {
+                                text[n++] = 0xe0 | (c >> 12);
+                                text[n++] = 0x80 | ((c >> 6) & 0x3f);
+                                text[n++] = 0x80 | (c & 0x3f);
+                            }
+                            text_layer_draw_text(tl, (text_layer_font){0}, text, text + n, 10, 10, SIZES[s]);
+                        }
+                    }
+                }
+            }
+            text_layer_draw(tl, (sg_sampler){0}, BENCH_GUI_WIDTH, BENCH_GUI_HEIGHT);
+            total_ns += xtime_now_ns() - t0;
+            bench_end_frame();
+
+            text_layer_get_stats(tl, &stats);
+            text_layer_destroy(tl);
+        }
+
+        report r = {"prerender", prerender ? "prerender" : "lazy"};
+        report_add(&r, "us", total_ns * 1e-3 / num_runs);
+        report_add(&r, "rastered", stats.total.glyphs_rasterized);
+        report_add(&r, "pages", stats.atlas_pages);
+        report_add(&r, "uploaded_kb", stats.total.atlas_bytes_uploaded / 1024.0);
+        report_print(&r);
+    }
+}
+
+// texture_array: one texture per atlas page against a single texture array holding every page. The labels are drawn
+// at many sizes, so their glyphs are spread over several pages. Per page textures need a draw call for every page
+// sampled, the texture array always needs one. submit_us is the time spent in text_layer_draw()
+static void draw_texture_array_frame(TextLayer* tl, int frame)
+{
+    for (int size = 10; size <= 48; size += 2)
+        draw_labels(tl, 0, (size - 10) * 20, size, 200, size);
+}
+
+static void add_texture_array_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    report_atlas(r, &stats);
+    report_add(r, "draw_calls", (double)times->warm_draw_calls / times->num_warm_frames);
+    report_add(r, "submit_us", warm_us(times, times->warm_submit_ns));
+    report_add(r, "uploaded_mb", stats.total.atlas_bytes_uploaded / (1024.0 * 1024.0));
+}
+
+static void scenario_texture_array(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"page_textures", {0}},
+        {"texture_array", {.atlas_texture_array = true}},
+    };
+    run_variants(
+        "texture_array",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(500),
+        draw_texture_array_frame,
+        add_texture_array_metrics);
+}
+
+// compaction: how much atlas memory compaction gives back after a zoom sweep. The session zooms through many font
+// sizes, filling lots of pages, then settles on one size for a while. Compacting drops the glyphs of sizes no longer
+// drawn and repacks the rest into as few pages as possible
+enum
+{
+    COMPACTION_MIN_FONT_SIZE   = 8,
+    COMPACTION_MAX_FONT_SIZE   = 64,
+    COMPACTION_FINAL_FONT_SIZE = 14,
+    COMPACTION_SETTLE_FRAMES   = 1000,
+};
+
+static void draw_compaction_frame(TextLayer* tl, int frame)
+{
+    int font_size = COMPACTION_MIN_FONT_SIZE + frame;
+    if (font_size > COMPACTION_MAX_FONT_SIZE)
+        font_size = COMPACTION_FINAL_FONT_SIZE;
+    draw_labels(tl, 10, 10, font_size, 200, font_size * 1.5f);
+}
+
+static void add_compaction_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    uint64_t                  t0     = xtime_now_ns();
+    text_layer_compact_result result = text_layer_compact_atlases(tl);
+    uint64_t                  t1     = xtime_now_ns();
+
+    report_add(r, "pages_before", result.pages_before);
+    report_add(r, "pages_after", result.pages_after);
+    report_add(r, "mb_before", result.bytes_before / (1024.0 * 1024.0));
+    report_add(r, "mb_after", result.bytes_after / (1024.0 * 1024.0));
+    report_add(r, "moved", result.glyphs_moved);
+    report_add(r, "dropped", result.glyphs_dropped);
+    report_add(r, "compact_us", (t1 - t0) * 1e-3);
+}
+
+static void scenario_compaction(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"page_textures", {0}},
+        {"texture_array", {.atlas_texture_array = true}},
+    };
+    const int num_zoom_frames = COMPACTION_MAX_FONT_SIZE - COMPACTION_MIN_FONT_SIZE + 1;
+    run_variants(
+        "compaction",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(num_zoom_frames) + bench_count(COMPACTION_SETTLE_FRAMES),
+        draw_compaction_frame,
+        add_compaction_metrics);
+}
+
+// size_classes: packing every glyph into the same atlas pages against packing large glyphs into pages of their own.
+// Small labels plus a large meter readout whose size animates from 36px to 96px, so large glyphs keep arriving while
+// the labels stay put. With a page budget, pages mixing both kinds are recycled and the labels are packed again
+static void draw_size_classes_frame(TextLayer* tl, int frame)
+{
+    draw_labels(tl, 10, 10, 11, 120, 16);
+
+    char readout[32];
+    snprintf(readout, sizeof(readout), "%+.1f LUFS", -30.0f + (frame * 13 % 300) * 0.1f);
+    text_layer_draw_text(tl, (text_layer_font){0}, readout, NULL, 10, 160, 36 + frame % 61);
+}
+
+static void add_size_classes_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    report_atlas(r, &stats);
+    report_add(r, "large_pages", stats.large_glyph_pages);
+    report_add(r, "packed", stats.total.glyphs_rasterized + stats.total.shared_glyph_hits);
+    report_add(r, "evicted", stats.total.evicted_glyphs);
+}
+
+static void scenario_size_classes(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"same_pages", {.large_glyph_size = -1}},
+        {"size_classes", {0}},
+        {"maxrects_large", {.large_glyph_packer = TEXT_LAYER_PACKER_MAXRECTS}},
+        {"same_pages_4", {.large_glyph_size = -1, .max_atlas_pages = 4}},
+        {"size_classes_4", {.max_atlas_pages = 4}},
+        {"maxrects_large_4", {.max_atlas_pages = 4, .large_glyph_packer = TEXT_LAYER_PACKER_MAXRECTS}},
+    };
+    run_variants(
+        "size_classes",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(300),
+        draw_size_classes_frame,
+        add_size_classes_metrics);
+}
+
+// oversized: a readout drawn at a size whose glyphs don't fit an empty page of max_atlas_page_size, next to the
+// labels. Page textures give those glyphs a page that grows until they fit. Texture array layers can't grow, so the
+// texture array drops them
+static void draw_oversized_frame(TextLayer* tl, int frame)
+{
+    draw_labels(tl, 10, 10, 11, 120, 16);
+    text_layer_draw_text(tl, (text_layer_font){0}, "-8.0", NULL, 10, 600, 480);
+}
+
+static void add_oversized_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    int largest_page = 0;
+    for (int i = 0; i < xarr_len(tl->glyph_atlases); i++)
+        if ((1 << tl->glyph_atlases[i].size_shift) > largest_page)
+            largest_page = 1 << tl->glyph_atlases[i].size_shift;
+
+    report_atlas(r, &stats);
+    report_add(r, "largest_page", largest_page);
+    report_add(r, "drawn", stats.last_frame.glyphs_drawn);
+}
+
+static void scenario_oversized(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"page_textures", {0}},
+        {"texture_array", {.atlas_texture_array = true}},
+    };
+    run_variants(
+        "oversized",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(10),
+        draw_oversized_frame,
+        add_oversized_metrics);
+}
+
+// uploads: uploading whole atlas pages, or the whole texture array, with sg_update_image() against uploading only the
+// region of each page or layer written since its last upload, through text_layer_desc.update_image_region. Draws the
+// size_classes frames, so new readout glyphs arrive every frame
+static void add_uploads_metrics(TextLayer* tl, const frame_times* times, report* r)
+{
+    text_layer_stats stats;
+    text_layer_get_stats(tl, &stats);
+
+    report_add(r, "pages", stats.atlas_pages);
+    report_add(r, "uploaded_mb", stats.total.atlas_bytes_uploaded / (1024.0 * 1024.0));
+    report_add(r, "submit_us", warm_us(times, times->warm_submit_ns));
+}
+
+// The dummy backend has no texture to write to. The layer counts the bytes it hands over
+static void update_image_region_nop(
+    sg_image    img,
+    int         layer,
+    int         x,
+    int         y,
+    int         w,
+    int         h,
+    const void* data,
+    int         row_stride,
+    void*       user_data)
+{
+}
+
+static void scenario_uploads(const char* font_path)
+{
+    static const variant VARIANTS[] = {
+        {"whole_pages", {0}},
+        {"page_regions", {.update_image_region = update_image_region_nop}},
+        {"whole_array", {.atlas_texture_array = true}},
+        {"layer_regions", {.atlas_texture_array = true, .update_image_region = update_image_region_nop}},
+    };
+    run_variants(
+        "uploads",
+        font_path,
+        VARIANTS,
+        ARRLEN(VARIANTS),
+        bench_count(300),
+        draw_size_classes_frame,
+        add_uploads_metrics);
+}
+
+// packers: the atlas packers on glyph streams recorded from the labels. Each stream is the sequence of glyph bitmaps a
+// text layer rasters while drawing the text at a range of font sizes, in the order they were first drawn. The packers
+// replay it online, one rect at a time as raster_glyph() does, into pages that start at 128x128 and double up to the
+// default maximum size before the next page is started. Occupancy is the part of those pages covered by glyphs,
+// padding included
+typedef struct glyph_stream
+{
+    const char* name;
+    const char* text;
+    // Font sizes the text is drawn at
+    float min_size, max_size, size_step;
+} glyph_stream;
+
+// Padded sizes of the glyphs a text layer packs while drawing the stream
+static stbrp_rect* record_stream(const char* font_path, const glyph_stream* stream)
+{
+    TextLayer* gui = new_layer(font_path, (text_layer_desc){0});
+
+    for (float size = stream->min_size; size <= stream->max_size; size += stream->size_step)
+    {
+        shaped_run run = {
+            .text      = (char*)stream->text,
+            .text_len  = strlen(stream->text),
+            .font_size = size,
+            .direction = KBTS_DIRECTION_DONT_KNOW,
+            .language  = KBTS_LANGUAGE_DONT_KNOW,
+        };
+        shape_text(gui, &run);
+        for (int i = 0; i < xarr_len(run.glyphs); i++)
+            get_glyph_rect(gui, 0, run.glyphs[i].id, size, 0);
+        xarr_free(run.glyphs);
+    }
+
+    // Pages are never recycled with an unlimited budget, so rects are in the order they were packed
+    stbrp_rect* rects = NULL;
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+    {
+        stbrp_rect rect = {.w = gui->rects[i].w + RECTPACK_PADDING, .h = gui->rects[i].h + RECTPACK_PADDING};
+        xarr_push(rects, rect);
+    }
+    text_layer_destroy(gui);
+    return rects;
+}
+
+static void replay_stream(const stbrp_rect* stream, text_layer_packer kind, report* r)
+{
+    const int num_repeats = bench_count(50);
+    const int num_rects   = xarr_len(stream);
+    uint64_t  glyph_area  = 0;
+    for (int i = 0; i < num_rects; i++)
+        glyph_area += stream[i].w * stream[i].h;
+
+    atlas_packer packer;
+    atlas_packer_init(&packer, kind);
+
+    uint64_t total_ns  = 0;
+    uint64_t page_area = 0;
+    int      num_pages = 0;
+    for (int rep = 0; rep < num_repeats; rep++)
+    {
+        int  size  = ATLAS_MIN_SIZE;
+        bool empty = true;
+        num_pages  = 1;
+        page_area  = 0;
+        atlas_packer_reset(&packer, size - RECTPACK_PADDING, size - RECTPACK_PADDING);
+
+        uint64_t t0 = xtime_now_ns();
+        for (int i = 0; i < num_rects; i++)
+        {
+            stbrp_rect rect = stream[i];
+            while (!atlas_packer_pack(&packer, &rect, 1))
+            {
+                if (size < ATLAS_DEFAULT_MAX_SIZE)
+                {
+                    size *= 2;
+                    atlas_packer_grow(&packer, size - RECTPACK_PADDING, size - RECTPACK_PADDING);
+                }
+                else if (!empty)
+                {
+                    page_area += size * size;
+                    num_pages++;
+                    size = ATLAS_MIN_SIZE;
+                    atlas_packer_reset(&packer, size - RECTPACK_PADDING, size - RECTPACK_PADDING);
+                }
+                else
+                {
+                    break; // Never fits
+                }
+            }
+            empty = false;
+        }
+        total_ns  += xtime_now_ns() - t0;
+        page_area += size * size;
+    }
+    atlas_packer_free(&packer);
+
+    report_add(r, "glyphs", num_rects);
+    report_add(r, "pages", num_pages);
+    report_add(r, "occupancy_pct", 100.0 * glyph_area / page_area);
+    report_add(r, "ns_per_glyph", (double)total_ns / (num_repeats * num_rects));
+}
+
+static void scenario_packers(const char* font_path)
+{
+    static const glyph_stream STREAMS[] = {
+        // A plugin UI with a few text styles
+        {"ui_labels", g_labels_text, 10, 16, 1},
+        // An animated zoom, like the glyph_modes scenario
+        {"zoom_sweep", g_labels_text, 8, 64, 0.5f},
+        // Meter readouts drawn at many sizes, small and large
+        {"readouts", "-0123456789.+dB Hz kHz ms % LUFS", 12, 96, 4},
+    };
+
+    static const struct
+    {
+        text_layer_packer packer;
+        const char*       name;
+    } PACKERS[] = {
+        {TEXT_LAYER_PACKER_SKYLINE_BL, "skyline_bl"},
+        {TEXT_LAYER_PACKER_SKYLINE_BF, "skyline_bf"},
+        {TEXT_LAYER_PACKER_MAXRECTS, "maxrects"},
+        {TEXT_LAYER_PACKER_SHELF, "shelf"},
+    };
+
+    for (int s = 0; s < ARRLEN(STREAMS); s++)
+    {
+        stbrp_rect* stream = record_stream(font_path, STREAMS + s);
+        for (int p = 0; p < ARRLEN(PACKERS); p++)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "%s/%s", STREAMS[s].name, PACKERS[p].name);
+            report r = {"packers", name};
+            replay_stream(stream, PACKERS[p].packer, &r);
+            report_print(&r);
+        }
+        xarr_free(stream);
+    }
+}
+
+typedef struct scenario
+{
+    const char* name;
+    void (*run)(const char* font_path);
+} scenario;
+
+static const scenario SCENARIOS[] = {
+    {"glyph_map", scenario_glyph_map},
+    {"shape_cache", scenario_shape_cache},
+    {"glyph_modes", scenario_glyph_modes},
+    {"subpixel", scenario_subpixel},
+    {"shared_cache", scenario_shared_cache},
+    {"atlas_cache", scenario_atlas_cache},
+    {"prerender", scenario_prerender},
+    {"texture_array", scenario_texture_array},
+    {"compaction", scenario_compaction},
+    {"size_classes", scenario_size_classes},
+    {"oversized", scenario_oversized},
+    {"uploads", scenario_uploads},
+    {"packers", scenario_packers},
+};
+
+static bool is_known_run(const char* name)
+{
+    if (strcmp(name, "stages") == 0)
+        return true;
+    for (int i = 0; i < ARRLEN(SCENARIOS); i++)
+        if (strcmp(name, SCENARIOS[i].name) == 0)
+            return true;
+    return false;
+}
+
+static bool should_run(const char** runs, int num_runs, const char* name)
+{
+    for (int i = 0; i < num_runs; i++)
+        if (strcmp(runs[i], name) == 0)
+            return true;
+    return num_runs == 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* fonts[MAX_FONTS];
+    int         num_fonts = 0;
+    const char* runs[MAX_RUNS];
+    int         num_runs = 0;
+
+    fonts[num_fonts++] = BENCH_ASSET_PATH("EBGaramond-Regular.ttf");
+    fonts[num_fonts++] = BENCH_ASSET_PATH("NotoSansHebrew-Regular.ttf");
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--json") == 0)
+        {
+            g_json = true;
+        }
+        else if (strcmp(argv[i], "--quick") == 0)
+        {
+            g_quick = true;
+        }
+        else if (strcmp(argv[i], "--font") == 0 && i + 1 < argc && num_fonts < MAX_FONTS)
+        {
+            fonts[num_fonts++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--run") == 0 && i + 1 < argc && num_runs < MAX_RUNS)
+        {
+            runs[num_runs++] = argv[++i];
+            if (!is_known_run(runs[num_runs - 1]))
+            {
+                fprintf(stderr, "Unknown benchmark %s. --list prints them\n", runs[num_runs - 1]);
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "--list") == 0)
+        {
+            printf("stages\n");
+            for (int s = 0; s < ARRLEN(SCENARIOS); s++)
+                printf("%s\n", SCENARIOS[s].name);
+            return 0;
+        }
+    }
+
+    int len = 0;
+    for (int i = 0; i < ARRLEN(LABELS); i++)
+        len += snprintf(g_labels_text + len, sizeof(g_labels_text) - len, i ? " %s" : "%s", LABELS[i]);
+
+    _sg_state_t* sg = bench_setup();
+
+    if (should_run(runs, num_runs, "stages"))
+        stages_suite(fonts, num_fonts);
+    for (int s = 0; s < ARRLEN(SCENARIOS); s++)
+        if (should_run(runs, num_runs, SCENARIOS[s].name))
+            SCENARIOS[s].run(fonts[0]);
+
+    bench_shutdown(sg);
+    return 0;
+}
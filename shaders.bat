@@ -1,5 +1,5 @@
-sokol-shdc -i src\shaders\text.glsl -o src\shaders\text.glsl.h -l hlsl5
-sokol-shdc -i src\shaders\img.glsl -o src\shaders\img.glsl.h -l hlsl5
+sokol-shdc -i src\shaders\text.glsl -o src\shaders\text.glsl.h -l hlsl5:glsl430
+sokol-shdc -i src\shaders\img.glsl -o src\shaders\img.glsl.h -l hlsl5:glsl430
 
 shader-hotreloader.exe -i src
 
@@ -1,2 +1,2 @@
-sokol-shdc -i src/shaders/text.glsl -o src/shaders/text.glsl.h -l metal_macos
-sokol-shdc -i src/shaders/img.glsl -o src/shaders/img.glsl.h -l metal_macos
\ No newline at end of file
+sokol-shdc -i src/shaders/text.glsl -o src/shaders/text.glsl.h -l metal_macos:glsl430
+sokol-shdc -i src/shaders/img.glsl -o src/shaders/img.glsl.h -l metal_macos:glsl430
\ No newline at end of file
@@ -2,7 +2,8 @@
 #ifndef PLUGIN_CONFIG_H
 #define PLUGIN_CONFIG_H
 
-#if !defined(_WIN32) && !defined(__APPLE__)
+// Other platforms can only build the headless text layer benchmarks
+#if !defined(_WIN32) && !defined(__APPLE__) && !defined(SOKOL_DUMMY_BACKEND)
 #error Unsupported OS
 #endif
 
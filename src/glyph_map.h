@@ -0,0 +1,160 @@
+#ifndef GLYPH_MAP_H
+#define GLYPH_MAP_H
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <xhl/alloc.h>
+#include <xhl/debug.h>
+
+// Open addressing hash table (linear probing) mapping a 64bit glyph key to an index in some external array.
+// Indices are stored +1 so that a zeroed slot means empty, which lets us allocate with calloc and accept any key,
+// including 0.
+// The table never holds more than half of its capacity, so probe sequences stay short.
+
+typedef struct glyph_map_slot
+{
+    uint64_t key;
+    uint32_t idx_plus_one;
+} glyph_map_slot;
+
+typedef struct glyph_map
+{
+    glyph_map_slot* slots;
+    uint32_t        cap; // Always a power of 2, or 0
+    uint32_t        len;
+} glyph_map;
+
+// https://github.com/skeeto/hash-prospector
+static inline uint64_t glyph_map_hash(uint64_t x)
+{
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93llu;
+    x ^= x >> 32;
+    x *= 0xd6e8feb86659fd93llu;
+    x ^= x >> 32;
+    return x;
+}
+
+static inline void glyph_map_free(glyph_map* map)
+{
+    if (map->slots)
+        xfree(map->slots);
+    memset(map, 0, sizeof(*map));
+}
+
+static inline void glyph_map_clear(glyph_map* map)
+{
+    if (map->slots)
+        memset(map->slots, 0, sizeof(*map->slots) * map->cap);
+    map->len = 0;
+}
+
+// Returns the stored index, or -1 if the key isn't in the map
+static inline int glyph_map_get(const glyph_map* map, uint64_t key)
+{
+    if (map->len == 0)
+        return -1;
+
+    const uint32_t mask = map->cap - 1;
+    uint32_t       i    = glyph_map_hash(key) & mask;
+    while (map->slots[i].idx_plus_one)
+    {
+        if (map->slots[i].key == key)
+            return (int)map->slots[i].idx_plus_one - 1;
+        i = (i + 1) & mask;
+    }
+    return -1;
+}
+
+static inline void glyph_map_reserve(glyph_map* map, uint32_t num)
+{
+    uint32_t new_cap = map->cap ? map->cap : 64;
+    while (new_cap < num * 2)
+        new_cap *= 2;
+    if (new_cap == map->cap)
+        return;
+
+    glyph_map_slot* old_slots = map->slots;
+    uint32_t        old_cap   = map->cap;
+
+    map->slots = xcalloc(new_cap, sizeof(*map->slots));
+    map->cap   = new_cap;
+
+    const uint32_t mask = new_cap - 1;
+    for (uint32_t j = 0; j < old_cap; j++)
+    {
+        if (old_slots[j].idx_plus_one)
+        {
+            uint32_t i = glyph_map_hash(old_slots[j].key) & mask;
+            while (map->slots[i].idx_plus_one)
+                i = (i + 1) & mask;
+            map->slots[i] = old_slots[j];
+        }
+    }
+
+    if (old_slots)
+        xfree(old_slots);
+}
+
+// Inserts or overwrites the index stored for key
+static inline void glyph_map_set(glyph_map* map, uint64_t key, int idx)
+{
+    xassert(idx >= 0);
+    glyph_map_reserve(map, map->len + 1);
+
+    const uint32_t mask = map->cap - 1;
+    uint32_t       i    = glyph_map_hash(key) & mask;
+    while (map->slots[i].idx_plus_one)
+    {
+        if (map->slots[i].key == key)
+        {
+            map->slots[i].idx_plus_one = idx + 1;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+    map->slots[i].key          = key;
+    map->slots[i].idx_plus_one = idx + 1;
+    map->len++;
+}
+
+// Backward shift deletion. Moves any following entries of the probe sequence into the hole so lookups never need
+// tombstones
+static inline void glyph_map_remove(glyph_map* map, uint64_t key)
+{
+    if (map->len == 0)
+        return;
+
+    const uint32_t mask = map->cap - 1;
+    uint32_t       i    = glyph_map_hash(key) & mask;
+    while (map->slots[i].key != key)
+    {
+        if (!map->slots[i].idx_plus_one)
+            return;
+        i = (i + 1) & mask;
+    }
+    if (!map->slots[i].idx_plus_one)
+        return;
+
+    uint32_t j = i;
+    while (true)
+    {
+        j = (j + 1) & mask;
+        if (!map->slots[j].idx_plus_one)
+            break;
+        uint32_t home = glyph_map_hash(map->slots[j].key) & mask;
+        // Only move the entry if its home slot is not cyclically within (i, j]
+        bool in_range = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+        if (!in_range)
+        {
+            map->slots[i] = map->slots[j];
+            i             = j;
+        }
+    }
+    map->slots[i].key          = 0;
+    map->slots[i].idx_plus_one = 0;
+    map->len--;
+}
+
+#endif // GLYPH_MAP_H
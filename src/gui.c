@@ -19,15 +19,18 @@
 
 #include <img.glsl.h>
 
+#ifdef _WIN32
+#define COBJMACROS
+#include <d3d11.h>
+#endif
+
 // TODO
-// Bind correct atlas img when drawing text
 // Handle variety of text alignments. eg TL, TC, TR, CL, CC, CR, BL, BC, BR
 // Handle proper blending of text so glyphs don't clip each other
 // Handle proper blending of text so subpixel antialiasing blends with background
 // Handle multiple fonts (bold/italic) & font sizes
 // Test mixed language strings (Try this? https://github.com/Tehreer/SheenBidi)
 // Add ability to clear font atlas on resize
-// Use smaller atlases 128x128 (RGBA 64kb)
 
 // https://utf8everywhere.org/
 // static const char* MY_TEXT = "abc";
@@ -134,6 +137,29 @@ static void my_sg_logger(
     println("[%s] %s %u:%s", LOG_LEVEL[log_level], message_or_null, line_nr, filename_or_null);
 }
 
+#ifdef _WIN32
+// Atlas pages are default usage textures when this is set, so only the rows holding new glyphs are copied to the GPU.
+// Metal makes render target images private, so macOS keeps uploading whole pages
+static void update_atlas_region_d3d11(
+    sg_image    img,
+    int         layer,
+    int         x,
+    int         y,
+    int         w,
+    int         h,
+    const void* data,
+    int         row_stride,
+    void*       user_data)
+{
+    GUI*                 gui = user_data;
+    ID3D11DeviceContext* ctx = (ID3D11DeviceContext*)pw_get_dx11_device_context(gui->pw);
+    ID3D11Resource*      tex = (ID3D11Resource*)sg_d3d11_query_image_info(img).tex2d;
+    const D3D11_BOX      box = {.left = x, .top = y, .front = 0, .right = x + w, .bottom = y + h, .back = 1};
+    // Atlas images have a single mip level, so the subresource index is the array layer
+    ID3D11DeviceContext_UpdateSubresource(ctx, tex, layer, &box, data, row_stride, 0);
+}
+#endif
+
 void* my_sg_allocator_alloc(size_t size, void* user_data)
 {
     void* ptr = MY_MALLOC(size);
@@ -211,8 +237,30 @@ void* pw_create_gui(void* _plugin, void* _pw)
 #endif
     xassert(xfiles_exists(font_path));
 
-    gui->tl = text_layer_new(font_path);
-    // text_layer_prerender_ascii(gui->tl, FONT_SIZE);
+    gui->tl = text_layer_new(&(text_layer_desc){
+        .font_path                     = font_path,
+        .max_atlas_pages               = 8,
+        .num_raster_threads            = 2,
+        .max_rasters_per_frame         = 64,
+#ifdef _WIN32
+        .update_image_region           = update_atlas_region_d3d11,
+        .update_image_region_user_data = gui,
+#endif
+    });
+    // const text_layer_codepoint_range ascii = {'!', '~'};
+    // text_layer_prerender(gui->tl, (text_layer_font){0}, &ascii, 1, &(float){FONT_SIZE}, 1);
+
+    // Scripts missing from the UI font
+    static const char* fallback_paths[] = {
+        SRC_DIR XFILES_DIR_STR "assets" XFILES_DIR_STR "NotoSansHebrew-Regular.ttf",
+#if defined(_WIN32)
+        "C:\\Windows\\Fonts\\Nirmala.ttf",
+        "C:\\Windows\\Fonts\\seguiemj.ttf",
+#endif
+    };
+    for (int i = 0; i < ARRLEN(fallback_paths); i++)
+        if (xfiles_exists(fallback_paths[i]))
+            text_layer_add_fallback_font(gui->tl, text_layer_add_font(gui->tl, fallback_paths[i]));
 
     gui->img_pip         = sg_make_pipeline(&(sg_pipeline_desc){
                 .shader = sg_make_shader(texread_shader_desc(sg_query_backend())),
@@ -281,6 +329,9 @@ void pw_tick(void* _gui)
     const int   gui_height = gui->plugin->height;
     const float dpi        = pw_get_dpi(gui->pw);
 
+    // Rasters glyphs again if the window moved to a display with a different scale
+    text_layer_set_backing_scale(gui->tl, dpi);
+
     // Begin frame
     {
         sg_color col_black = {0, 0, 0, 1.0f};
@@ -325,7 +376,8 @@ void pw_tick(void* _gui)
     int pen_x = 10;                                 // Horizontal centre
     int pen_y = (gui_height / 2) - (FONT_SIZE / 2); // Vertical centre
 
-    text_layer_draw_text(gui->tl, MY_TEXT, NULL, pen_x, pen_y, FONT_SIZE);
+    text_layer_draw_text(gui->tl, (text_layer_font){0}, MY_TEXT, NULL, pen_x, pen_y, FONT_SIZE);
+    // Bitmap glyphs are drawn nearest neighbour. Distance field glyph modes sample with the layer's linear sampler
     text_layer_draw(gui->tl, gui->sampler_nearest, gui_width, gui_height);
 
     sg_end_pass();
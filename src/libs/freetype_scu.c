@@ -6,7 +6,7 @@
 #endif
 #endif
 
-#ifdef __APPLE__
+#if defined(__APPLE__) || defined(__linux__)
 #define HAVE_FCNTL_H
 #define HAVE_UNISTD_H
 #endif
@@ -47,9 +47,6 @@
 // Rasterizers we dont need
 // monochrome rasterizer
 // #include "../../modules/freetype/src/raster/raster.c"
-// // SDF rasterizer
-// #include "../../modules/freetype/src/sdf/sdf.c"
-// #undef ONE_PIXEL
 
 // #include "../../modules/freetype/src/base/ftbbox.c"
 // #include "../../modules/freetype/src/base/ftpatent.c"
@@ -73,6 +70,9 @@
 
 // #include "../../modules/freetype/src/svg/svg.c"
 #include "../../modules/freetype/src/smooth/smooth.c"
+// SDF rasterizer, used by TEXT_LAYER_GLYPH_SDF
+#include "../../modules/freetype/src/sdf/sdf.c"
+#undef ONE_PIXEL
 // #include "../../modules/freetype/src/cff/cff.c"
 
 // We probably want this?
@@ -101,6 +101,11 @@
 #include "../../modules/freetype/builds/unix/ftsystem.c"
 #endif
 
+#ifdef __linux__
+#include "../../modules/freetype/src/base/ftdebug.c"
+#include "../../modules/freetype/builds/unix/ftsystem.c"
+#endif
+
 // TODO: remove
 // Support for zipped font files we don't need
 // This include some source code (crc32.c) that uses #define N {some_constant} and #define W {some_constant}
@@ -26,8 +26,8 @@ FT_USE_MODULE( FT_Driver_ClassRec, tt_driver_class )
 FT_USE_MODULE( FT_Module_Class, sfnt_module_class )
 FT_USE_MODULE( FT_Renderer_Class, ft_smooth_renderer_class )
 // FT_USE_MODULE( FT_Renderer_Class, ft_raster1_renderer_class )
-// FT_USE_MODULE( FT_Renderer_Class, ft_sdf_renderer_class )
-// FT_USE_MODULE( FT_Renderer_Class, ft_bitmap_sdf_renderer_class )
+FT_USE_MODULE( FT_Renderer_Class, ft_sdf_renderer_class )
+FT_USE_MODULE( FT_Renderer_Class, ft_bitmap_sdf_renderer_class )
 // FT_USE_MODULE( FT_Renderer_Class, ft_svg_renderer_class )
 
 /* EOF */
@@ -0,0 +1,4 @@
+// Used by the benchmarks, which run without a window or GPU
+#define SOKOL_IMPL
+#define SOKOL_DUMMY_BACKEND
+#include <sokol_gfx.h>
@@ -0,0 +1,380 @@
+#ifndef MSDF_H
+#define MSDF_H
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <xhl/alloc.h>
+#include <xhl/array.h>
+#include <xhl/debug.h>
+
+// Multi-channel signed distance field generator, after Viktor Chlumský's msdfgen
+// https://github.com/Chlumsky/msdfgen
+//
+// Build a shape from a glyph outline with msdf_move_to() & co, in pixels with y pointing up, then call
+// msdf_generate(). Edges are coloured so that every corner is the meeting point of two edges that share only one
+// channel. Each channel stores the signed pseudo-distance to the nearest edge of its colour, so the median of the
+// three reconstructs sharp corners at any magnification.
+// Curves are flattened into line segments. Pseudo-distances are only extended past the ends of the original edges,
+// so the flattening doesn't introduce corners.
+// The alpha channel holds the true signed distance, which is also used to repair texels whose median lands on the
+// wrong side of the outline.
+
+enum
+{
+    MSDF_RED     = 1,
+    MSDF_GREEN   = 2,
+    MSDF_BLUE    = 4,
+    MSDF_YELLOW  = MSDF_RED | MSDF_GREEN,
+    MSDF_MAGENTA = MSDF_RED | MSDF_BLUE,
+    MSDF_CYAN    = MSDF_GREEN | MSDF_BLUE,
+    MSDF_WHITE   = MSDF_RED | MSDF_GREEN | MSDF_BLUE,
+
+    MSDF_QUAD_SEGMENTS  = 6,
+    MSDF_CUBIC_SEGMENTS = 10,
+};
+
+typedef struct msdf_vec2
+{
+    float x, y;
+} msdf_vec2;
+
+typedef struct msdf_edge
+{
+    // Control points. Lines use 2, quadratic curves 3, cubic curves 4
+    msdf_vec2 p[4];
+    int       num_points;
+    int       colour;
+} msdf_edge;
+
+typedef struct msdf_shape
+{
+    msdf_edge* edges;
+    // Index one past the last edge of each contour
+    int* contour_ends;
+
+    msdf_vec2 start;
+    msdf_vec2 cursor;
+} msdf_shape;
+
+static inline msdf_vec2 msdf_sub(msdf_vec2 a, msdf_vec2 b) { return (msdf_vec2){a.x - b.x, a.y - b.y}; }
+static inline float     msdf_dot(msdf_vec2 a, msdf_vec2 b) { return a.x * b.x + a.y * b.y; }
+static inline float     msdf_cross(msdf_vec2 a, msdf_vec2 b) { return a.x * b.y - a.y * b.x; }
+static inline msdf_vec2 msdf_normalise(msdf_vec2 v)
+{
+    float len = sqrtf(msdf_dot(v, v));
+    return len > 0 ? (msdf_vec2){v.x / len, v.y / len} : (msdf_vec2){0, 0};
+}
+
+static inline void msdf_shape_free(msdf_shape* shape)
+{
+    xarr_free(shape->edges);
+    xarr_free(shape->contour_ends);
+    memset(shape, 0, sizeof(*shape));
+}
+
+static inline void msdf_close_contour(msdf_shape* shape)
+{
+    const int num_edges     = xarr_len(shape->edges);
+    const int num_contours  = xarr_len(shape->contour_ends);
+    const int contour_start = num_contours ? shape->contour_ends[num_contours - 1] : 0;
+    if (num_edges == contour_start)
+        return;
+
+    if (shape->cursor.x != shape->start.x || shape->cursor.y != shape->start.y)
+    {
+        msdf_edge edge = {.p = {shape->cursor, shape->start}, .num_points = 2};
+        xarr_push(shape->edges, edge);
+    }
+    xarr_push(shape->contour_ends, xarr_len(shape->edges));
+    shape->cursor = shape->start;
+}
+
+static inline void msdf_move_to(msdf_shape* shape, float x, float y)
+{
+    msdf_close_contour(shape);
+    shape->start = shape->cursor = (msdf_vec2){x, y};
+}
+
+static inline void msdf_line_to(msdf_shape* shape, float x, float y)
+{
+    msdf_vec2 p = {x, y};
+    if (p.x == shape->cursor.x && p.y == shape->cursor.y)
+        return;
+    msdf_edge edge = {.p = {shape->cursor, p}, .num_points = 2};
+    xarr_push(shape->edges, edge);
+    shape->cursor = p;
+}
+
+static inline void msdf_quad_to(msdf_shape* shape, float cx, float cy, float x, float y)
+{
+    msdf_edge edge = {.p = {shape->cursor, {cx, cy}, {x, y}}, .num_points = 3};
+    xarr_push(shape->edges, edge);
+    shape->cursor = (msdf_vec2){x, y};
+}
+
+static inline void msdf_cubic_to(msdf_shape* shape, float cx0, float cy0, float cx1, float cy1, float x, float y)
+{
+    msdf_edge edge = {.p = {shape->cursor, {cx0, cy0}, {cx1, cy1}, {x, y}}, .num_points = 4};
+    xarr_push(shape->edges, edge);
+    shape->cursor = (msdf_vec2){x, y};
+}
+
+static inline msdf_vec2 msdf_edge_point(const msdf_edge* edge, float t)
+{
+    const msdf_vec2* p = edge->p;
+    const float      u = 1 - t;
+    if (edge->num_points == 2)
+        return (msdf_vec2){u * p[0].x + t * p[1].x, u * p[0].y + t * p[1].y};
+    if (edge->num_points == 3)
+        return (msdf_vec2){
+            u * u * p[0].x + 2 * u * t * p[1].x + t * t * p[2].x,
+            u * u * p[0].y + 2 * u * t * p[1].y + t * t * p[2].y,
+        };
+    return (msdf_vec2){
+        u * u * u * p[0].x + 3 * u * u * t * p[1].x + 3 * u * t * t * p[2].x + t * t * t * p[3].x,
+        u * u * u * p[0].y + 3 * u * u * t * p[1].y + 3 * u * t * t * p[2].y + t * t * t * p[3].y,
+    };
+}
+
+// Tangent direction at the start or end of an edge, skipping control points that coincide with the end point
+static inline msdf_vec2 msdf_edge_direction(const msdf_edge* edge, bool at_end)
+{
+    const int last = edge->num_points - 1;
+    for (int i = 1; i <= last; i++)
+    {
+        msdf_vec2 d = at_end ? msdf_sub(edge->p[last], edge->p[last - i]) : msdf_sub(edge->p[i], edge->p[0]);
+        if (d.x != 0 || d.y != 0)
+            return msdf_normalise(d);
+    }
+    return (msdf_vec2){0, 0};
+}
+
+// Two edges meet at a corner unless they continue in nearly the same direction. Same threshold as msdfgen's default
+static inline bool msdf_is_corner(msdf_vec2 a, msdf_vec2 b)
+{
+    return msdf_dot(a, b) <= 0 || fabsf(msdf_cross(a, b)) > 0.14112f; // sin(3)
+}
+
+// msdfgen's "simple" edge colouring
+static inline void msdf_colour_edges(msdf_shape* shape)
+{
+    static const int colours[3] = {MSDF_CYAN, MSDF_MAGENTA, MSDF_YELLOW};
+
+    int corners[64];
+    int contour_start = 0;
+    for (int c = 0; c < xarr_len(shape->contour_ends); c++)
+    {
+        const int  contour_end = shape->contour_ends[c];
+        const int  n           = contour_end - contour_start;
+        msdf_edge* edges       = shape->edges + contour_start;
+
+        int num_corners = 0;
+        for (int i = 0; i < n && num_corners < (int)(sizeof(corners) / sizeof(corners[0])); i++)
+        {
+            msdf_vec2 prev = msdf_edge_direction(edges + (i + n - 1) % n, true);
+            msdf_vec2 next = msdf_edge_direction(edges + i, false);
+            if (msdf_is_corner(prev, next))
+                corners[num_corners++] = i;
+        }
+
+        if (num_corners == 0)
+        {
+            // Smooth contour
+            for (int i = 0; i < n; i++)
+                edges[i].colour = MSDF_WHITE;
+        }
+        else if (num_corners == 1)
+        {
+            // Teardrop. Split the contour into thirds starting at the corner
+            static const int teardrop[3] = {MSDF_MAGENTA, MSDF_WHITE, MSDF_YELLOW};
+            for (int i = 0; i < n; i++)
+                edges[(corners[0] + i) % n].colour = n < 3 ? teardrop[i * 2] : teardrop[i * 3 / n];
+        }
+        else
+        {
+            // Switch colour at every corner. The last spline must also differ from the first
+            for (int k = 0; k < num_corners; k++)
+            {
+                int colour = colours[k % 3];
+                if (k == num_corners - 1 && k % 3 == 0)
+                    colour = colours[1];
+
+                const int end = k + 1 < num_corners ? corners[k + 1] : corners[0] + n;
+                for (int i = corners[k]; i < end; i++)
+                    edges[i % n].colour = colour;
+            }
+        }
+        contour_start = contour_end;
+    }
+}
+
+typedef struct msdf_segment
+{
+    msdf_vec2 a, b;
+    int       edge;
+    bool      first, last; // Segment is at the start/end of its edge
+} msdf_segment;
+
+typedef struct msdf_candidate
+{
+    float distance;      // Unsigned true distance
+    float orthogonality; // |cos| between the edge and the direction to the point. Lower wins ties
+    float pseudo;        // Signed pseudo-distance
+} msdf_candidate;
+
+static inline bool msdf_candidate_less(const msdf_candidate* a, const msdf_candidate* b)
+{
+    const float eps = 1e-4f;
+    if (a->distance < b->distance - eps)
+        return true;
+    return a->distance <= b->distance + eps && a->orthogonality < b->orthogonality;
+}
+
+static inline unsigned char msdf_encode(float distance, float range)
+{
+    float v = 0.5f + distance / (2 * range);
+    v       = v < 0 ? 0 : v > 1 ? 1 : v;
+    return (unsigned char)(v * 255 + 0.5f);
+}
+
+static inline float msdf_median(float r, float g, float b)
+{
+    return fmaxf(fminf(r, g), fminf(fmaxf(r, g), b));
+}
+
+// Generates an RGBA8 distance field with a border of range pixels around the shape. Distances of +/- range map to
+// 255/0, and 128 lies on the outline. Returns NULL for an empty shape. Free the result with xfree().
+// left and top are the offset of the top left texel from the glyph origin, in pixels with y pointing up
+static inline unsigned char*
+msdf_generate(msdf_shape* shape, float range, int* out_width, int* out_height, int* out_left, int* out_top)
+{
+    msdf_close_contour(shape);
+
+    const int num_edges = xarr_len(shape->edges);
+    if (num_edges == 0)
+        return NULL;
+
+    msdf_colour_edges(shape);
+
+    // Flatten & measure
+    msdf_segment* segments = NULL;
+    xarr_setcap(segments, num_edges * MSDF_CUBIC_SEGMENTS);
+    float xmin = INFINITY, ymin = INFINITY, xmax = -INFINITY, ymax = -INFINITY;
+    float area = 0;
+    for (int e = 0; e < num_edges; e++)
+    {
+        const msdf_edge* edge = shape->edges + e;
+        for (int i = 0; i < edge->num_points; i++)
+        {
+            xmin = fminf(xmin, edge->p[i].x);
+            xmax = fmaxf(xmax, edge->p[i].x);
+            ymin = fminf(ymin, edge->p[i].y);
+            ymax = fmaxf(ymax, edge->p[i].y);
+        }
+
+        const int n = edge->num_points == 2 ? 1 : edge->num_points == 3 ? MSDF_QUAD_SEGMENTS : MSDF_CUBIC_SEGMENTS;
+        msdf_vec2 a = edge->p[0];
+        for (int i = 1; i <= n; i++)
+        {
+            msdf_vec2    b   = i == n ? edge->p[edge->num_points - 1] : msdf_edge_point(edge, (float)i / n);
+            msdf_segment seg = {.a = a, .b = b, .edge = e, .first = i == 1, .last = i == n};
+            xarr_push(segments, seg);
+            area += msdf_cross(a, b);
+            a     = b;
+        }
+    }
+    // Pseudo-distances are positive on the left of an edge. Flip them if the outer contours run clockwise, as they do
+    // in TrueType fonts, so that inside is always positive
+    const float orientation = area < 0 ? -1 : 1;
+
+    const int left   = (int)floorf(xmin - range);
+    const int top    = (int)ceilf(ymax + range);
+    const int width  = (int)ceilf(xmax + range) - left;
+    const int height = top - (int)floorf(ymin - range);
+
+    unsigned char* pixels       = xmalloc(width * height * 4);
+    const int      num_segments = xarr_len(segments);
+
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const msdf_vec2 p = {left + x + 0.5f, top - y - 0.5f};
+
+            msdf_candidate channel[3];
+            for (int c = 0; c < 3; c++)
+                channel[c] = (msdf_candidate){INFINITY, INFINITY, 0};
+            float min_distance = INFINITY;
+            int   winding      = 0;
+
+            for (int s = 0; s < num_segments;)
+            {
+                // Closest segment of this edge
+                const int      e    = segments[s].edge;
+                msdf_candidate best = {INFINITY, INFINITY, 0};
+                for (; s < num_segments && segments[s].edge == e; s++)
+                {
+                    const msdf_segment* seg = segments + s;
+
+                    if ((seg->a.y <= p.y) != (seg->b.y <= p.y))
+                    {
+                        float t = (p.y - seg->a.y) / (seg->b.y - seg->a.y);
+                        if (seg->a.x + t * (seg->b.x - seg->a.x) > p.x)
+                            winding += seg->b.y > seg->a.y ? 1 : -1;
+                    }
+
+                    msdf_vec2 d   = msdf_sub(seg->b, seg->a);
+                    msdf_vec2 aq  = msdf_sub(p, seg->a);
+                    float     len = msdf_dot(d, d);
+                    float     t   = len > 0 ? msdf_dot(aq, d) / len : 0;
+                    float     tc  = t < 0 ? 0 : t > 1 ? 1 : t;
+
+                    msdf_vec2 closest = {seg->a.x + d.x * tc, seg->a.y + d.y * tc};
+                    msdf_vec2 qp      = msdf_sub(p, closest);
+
+                    msdf_candidate cand;
+                    cand.distance      = sqrtf(msdf_dot(qp, qp));
+                    cand.orthogonality = fabsf(msdf_dot(msdf_normalise(d), msdf_normalise(qp)));
+                    float side         = msdf_cross(d, aq) * orientation >= 0 ? 1 : -1;
+                    cand.pseudo        = side * cand.distance;
+                    // Past the end of an edge, measure to the extended edge so corners stay sharp
+                    if (len > 0 && ((seg->first && t < 0) || (seg->last && t > 1)))
+                        cand.pseudo = msdf_cross(d, aq) * orientation / sqrtf(len);
+
+                    if (msdf_candidate_less(&cand, &best))
+                        best = cand;
+                }
+
+                min_distance = fminf(min_distance, best.distance);
+                for (int c = 0; c < 3; c++)
+                    if ((shape->edges[e].colour & (1 << c)) && msdf_candidate_less(&best, channel + c))
+                        channel[c] = best;
+            }
+
+            const float true_distance = winding != 0 ? min_distance : -min_distance;
+
+            float r = channel[0].pseudo, g = channel[1].pseudo, b = channel[2].pseudo;
+            // The median must agree with the true distance on which side of the outline the texel is
+            if ((msdf_median(r, g, b) > 0) != (true_distance > 0))
+                r = g = b = true_distance;
+
+            unsigned char* px = pixels + (y * width + x) * 4;
+            px[0]             = msdf_encode(r, range);
+            px[1]             = msdf_encode(g, range);
+            px[2]             = msdf_encode(b, range);
+            px[3]             = msdf_encode(true_distance, range);
+        }
+    }
+
+    xarr_free(segments);
+
+    *out_width  = width;
+    *out_height = height;
+    *out_left   = left;
+    *out_top    = top;
+    return pixels;
+}
+
+#endif // MSDF_H
@@ -7,6 +7,8 @@ struct text_buffer
     vec2 coord_bottomright;
     uint tex_topleft;
     uint tex_bottomright;
+    // Layer in the atlas texture array. Unused with one texture per atlas page
+    uint page;
 };
 
 layout(binding=0) readonly buffer sb_text {
@@ -17,7 +19,7 @@ layout(binding=0) uniform vs_text_uniforms {
     vec2 size;
 };
 
-out vec2 texcoord;
+out vec3 texcoord;
 
 
 void main() {
@@ -50,9 +52,10 @@ void main() {
 
     vec2 tex_topleft = unpackUnorm2x16(obj.tex_topleft);
     vec2 tex_bottomright = unpackUnorm2x16(obj.tex_bottomright);
-    texcoord = vec2(
+    texcoord = vec3(
         is_right  ? tex_bottomright.x : tex_topleft.x,
-        is_bottom ? tex_bottomright.y : tex_topleft.y
+        is_bottom ? tex_bottomright.y : tex_topleft.y,
+        float(obj.page)
     );
 }
 @end
@@ -66,11 +69,11 @@ layout(binding=1) uniform fs_text_singlechannel {
 };
 
 
-in vec2 texcoord;
+in vec3 texcoord;
 out vec4 frag_colour;
 
 void main() {
-    float alpha = texture(sampler2D(text_tex, text_smp), texcoord).r;
+    float alpha = texture(sampler2D(text_tex, text_smp), texcoord.xy).r;
     frag_colour = vec4(u_colour.rgb, u_colour.a * alpha);
 }
 @end
@@ -79,13 +82,139 @@ void main() {
 layout(binding=1) uniform texture2D text_tex;
 layout(binding=0) uniform sampler text_smp;
 
-in vec2 texcoord;
+in vec3 texcoord;
 out vec4 frag_colour;
 
 void main() {
-    frag_colour = texture(sampler2D(text_tex, text_smp), texcoord);
+    frag_colour = texture(sampler2D(text_tex, text_smp), texcoord.xy);
+}
+@end
+
+@fs fs_text_sdf
+layout(binding=1) uniform texture2D text_tex;
+layout(binding=0) uniform sampler text_smp;
+
+layout(binding=1) uniform fs_text_sdf {
+    vec4 u_colour;
+};
+
+in vec3 texcoord;
+out vec4 frag_colour;
+
+void main() {
+    // 0.5 is the glyph outline. Antialias over roughly one screen pixel, whatever size the field is drawn at
+    float dist = texture(sampler2D(text_tex, text_smp), texcoord.xy).r;
+    float width = fwidth(dist) * 0.5;
+    float alpha = smoothstep(0.5 - width, 0.5 + width, dist);
+    frag_colour = vec4(u_colour.rgb, u_colour.a * alpha);
+}
+@end
+
+@block median
+float median(float r, float g, float b) {
+    return max(min(r, g), min(max(r, g), b));
+}
+@end
+
+@fs fs_text_msdf
+layout(binding=1) uniform texture2D text_tex;
+layout(binding=0) uniform sampler text_smp;
+
+layout(binding=1) uniform fs_text_msdf {
+    vec4 u_colour;
+};
+
+in vec3 texcoord;
+out vec4 frag_colour;
+
+@include_block median
+
+void main() {
+    // The median of the three channels is the distance to the outline, with corners intact
+    vec3 msd = texture(sampler2D(text_tex, text_smp), texcoord.xy).rgb;
+    float dist = median(msd.r, msd.g, msd.b);
+    float width = fwidth(dist) * 0.5;
+    float alpha = smoothstep(0.5 - width, 0.5 + width, dist);
+    frag_colour = vec4(u_colour.rgb, u_colour.a * alpha);
+}
+@end
+
+/* Same as above, sampling every atlas page as a layer of one texture array */
+@fs fs_text_singlechannel_array
+layout(binding=1) uniform texture2DArray text_tex_array;
+layout(binding=0) uniform sampler text_smp;
+
+layout(binding=1) uniform fs_text_singlechannel {
+    vec4 u_colour;
+};
+
+in vec3 texcoord;
+out vec4 frag_colour;
+
+void main() {
+    float alpha = texture(sampler2DArray(text_tex_array, text_smp), texcoord).r;
+    frag_colour = vec4(u_colour.rgb, u_colour.a * alpha);
+}
+@end
+
+@fs fs_text_multichannel_array
+layout(binding=1) uniform texture2DArray text_tex_array;
+layout(binding=0) uniform sampler text_smp;
+
+in vec3 texcoord;
+out vec4 frag_colour;
+
+void main() {
+    frag_colour = texture(sampler2DArray(text_tex_array, text_smp), texcoord);
+}
+@end
+
+@fs fs_text_sdf_array
+layout(binding=1) uniform texture2DArray text_tex_array;
+layout(binding=0) uniform sampler text_smp;
+
+layout(binding=1) uniform fs_text_sdf {
+    vec4 u_colour;
+};
+
+in vec3 texcoord;
+out vec4 frag_colour;
+
+void main() {
+    float dist = texture(sampler2DArray(text_tex_array, text_smp), texcoord).r;
+    float width = fwidth(dist) * 0.5;
+    float alpha = smoothstep(0.5 - width, 0.5 + width, dist);
+    frag_colour = vec4(u_colour.rgb, u_colour.a * alpha);
+}
+@end
+
+@fs fs_text_msdf_array
+layout(binding=1) uniform texture2DArray text_tex_array;
+layout(binding=0) uniform sampler text_smp;
+
+layout(binding=1) uniform fs_text_msdf {
+    vec4 u_colour;
+};
+
+in vec3 texcoord;
+out vec4 frag_colour;
+
+@include_block median
+
+void main() {
+    vec3 msd = texture(sampler2DArray(text_tex_array, text_smp), texcoord).rgb;
+    float dist = median(msd.r, msd.g, msd.b);
+    float width = fwidth(dist) * 0.5;
+    float alpha = smoothstep(0.5 - width, 0.5 + width, dist);
+    frag_colour = vec4(u_colour.rgb, u_colour.a * alpha);
 }
 @end
 
 @program text_singlechannel vs_text fs_text_singlechannel
-@program text_multichannel vs_text fs_text_multichannel
\ No newline at end of file
+@program text_multichannel vs_text fs_text_multichannel
+@program text_sdf vs_text fs_text_sdf
+@program text_msdf vs_text fs_text_msdf
+@program text_singlechannel_array vs_text fs_text_singlechannel_array
+@program text_multichannel_array vs_text fs_text_multichannel_array
+@program text_sdf_array vs_text fs_text_sdf_array
+@program text_msdf_array vs_text fs_text_msdf_array
\ No newline at end of file
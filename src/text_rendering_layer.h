@@ -4,13 +4,230 @@
 
 typedef struct TextLayer TextLayer;
 
-TextLayer* text_layer_new(const char* font_path);
+// Uploads a sub rectangle of an atlas page. layer is the texture array layer, and 0 for page images. data points to the
+// top left pixel of the region and rows are row_stride bytes apart. sokol_gfx can only replace whole images, so this
+// is how a backend that supports partial texture updates can opt in to them. See update_atlas_region_d3d11() in gui.c
+typedef void (*text_layer_update_image_region_fn)(
+    sg_image    img,
+    int         layer,
+    int         x,
+    int         y,
+    int         w,
+    int         h,
+    const void* data,
+    int         row_stride,
+    void*       user_data);
+
+enum
+{
+    TEXT_LAYER_MAX_SUBPIXEL_BINS   = 8,
+    TEXT_LAYER_MAX_FONTS           = 16,
+    TEXT_LAYER_MAX_ATLAS_PAGE_SIZE = 4096,
+};
+
+// Handle to a font added with text_layer_add_font(). The zero handle is the font given in text_layer_desc.font_path
+typedef struct text_layer_font
+{
+    uint32_t id;
+} text_layer_font;
+
+typedef enum text_layer_glyph_mode
+{
+    // One antialiased bitmap per glyph per font size. Sharpest at small sizes
+    TEXT_LAYER_GLYPH_BITMAP,
+    // One signed distance field per glyph, rastered at a reference size and scaled to any font size. Keeps the atlas
+    // small when text is zoomed or drawn at many sizes. Needs bilinear filtering, so the layer samples distance field
+    // pages with its own linear sampler. Requires a single channel atlas
+    TEXT_LAYER_GLYPH_SDF,
+    // Like TEXT_LAYER_GLYPH_SDF, with a distance per colour channel so corners stay sharp when magnified. Generated
+    // from the glyph outline into RGBA8 atlas pages. Not supported with RASTER_FREETYPE_MULTICHANNEL
+    TEXT_LAYER_GLYPH_MSDF,
+} text_layer_glyph_mode;
+
+// How glyphs are placed in atlas pages. Glyphs are packed online, one at a time as they're first drawn, and a page is
+// never repacked until it's recycled or compacted
+typedef enum text_layer_packer
+{
+    // Skyline, placing each glyph as low as it fits, then as far left
+    TEXT_LAYER_PACKER_SKYLINE_BL,
+    // Skyline, placing each glyph where it leaves the least space below it unusable
+    TEXT_LAYER_PACKER_SKYLINE_BF,
+    // Tracks every maximal free rectangle and places each glyph in the one it fits most snugly (best short side fit).
+    // Packs the densest when font sizes vary, at about 10x the cost per glyph of a skyline
+    TEXT_LAYER_PACKER_MAXRECTS,
+    // Rows of glyphs of similar height. Heights are rounded up to a class and each row only takes glyphs of its class.
+    // The cheapest, but wastes the most space when font sizes vary
+    TEXT_LAYER_PACKER_SHELF,
+} text_layer_packer;
+
+typedef struct text_layer_desc
+{
+    const char* font_path;
+
+    text_layer_glyph_mode glyph_mode;
+    // 0 is TEXT_LAYER_PACKER_SKYLINE_BL
+    text_layer_packer packer;
+
+    // Physical pixels per GUI unit. Glyph bitmaps are rastered at this density while positions and font sizes stay in
+    // GUI units. Fractional scales such as 1.25 are supported. 0 uses the platform default: 2 on macOS, 1 elsewhere.
+    // See text_layer_set_backing_scale()
+    float backing_scale;
+
+    // Maximum number of atlas pages kept on the GPU. When reached, the least recently used page is cleared and reused.
+    // 0 means unlimited
+    int max_atlas_pages;
+    // Atlas pages start at 128x128 and double in place as glyphs are added, up to this size, before another page is
+    // made. Must be a power of 2 from 128 to TEXT_LAYER_MAX_ATLAS_PAGE_SIZE. 0 means 256. Pages of a texture array
+    // are always this size. A glyph too big for an empty page of this size gets a page that keeps doubling until the
+    // glyph fits, up to TEXT_LAYER_MAX_ATLAS_PAGE_SIZE. Glyphs that still don't fit, or don't fit a texture array
+    // layer, aren't drawn
+    int max_atlas_page_size;
+    // Glyphs wider or taller than this, in physical pixels, are packed into pages of their own, so a few display sized
+    // glyphs don't fragment the pages small text is packed into. Once max_atlas_pages is reached, either kind of page
+    // recycles its own least recently used page first. 0 means 32. Negative packs every glyph into the same pages
+    int large_glyph_size;
+    // Packer for the pages of large glyphs. packer is used for the rest. 0 is TEXT_LAYER_PACKER_SKYLINE_BL
+    text_layer_packer large_glyph_packer;
+    // Repack the atlas into fewer pages when the glyphs drawn in the last few seconds fill less than this fraction of
+    // it. Checked every 256 frames while there's more than one page. 0 disables it. See text_layer_compact_atlases()
+    float atlas_compact_threshold;
+    // Maximum number of glyphs drawn per frame. Glyphs past this are dropped and counted in text_layer_stats.
+    // 0 means unlimited
+    int max_glyphs;
+
+    // Shaped runs are cached by default, so static labels skip shaping entirely
+    bool disable_shape_cache;
+
+    // Number of horizontal subpixel positions glyph bitmaps are rastered at. Glyphs are placed at the nearest
+    // 1/subpixel_bins of a pixel, which evens out letter spacing at small sizes. Each bin is a separate atlas entry.
+    // Must be a power of 2 up to TEXT_LAYER_MAX_SUBPIXEL_BINS. 0 or 1 snaps glyphs to whole pixels. Ignored by the
+    // distance field modes, which are drawn at the exact position
+    int subpixel_bins;
+
+    // Number of threads rastering glyph cache misses in the background. Each has its own FreeType face. Glyphs are
+    // skipped until their raster is finished, then packed into the atlas in text_layer_draw() and drawn from the next
+    // frame on. 0 rasters misses on the calling thread. Only supported with FreeType rasterization
+    int num_raster_threads;
+    // Maximum number of finished glyphs packed into the atlas per frame. 0 means unlimited
+    int max_rasters_per_frame;
+
+    // Optional file caching atlas pages between sessions. Read by text_layer_new() and written by
+    // text_layer_destroy(), so reopening an editor uploads ready made pages instead of rastering every glyph again.
+    // Glyphs are matched by font file contents, size and backing scale. The file is ignored if it was written with a
+    // different glyph mode, subpixel_bins or rasterizer
+    const char* atlas_cache_path;
+
+    // Keep atlas pages as layers of a single texture array, so all text is drawn with one draw call however many
+    // pages are live. The array doubles its layer count when full. sokol can only replace the whole array, so without
+    // update_image_region a frame that rasters new glyphs uploads every layer
+    bool atlas_texture_array;
+
+    // Optional. When set, only the region of an atlas page or texture array layer touched since the last upload is
+    // uploaded. Otherwise the whole page is uploaded with sg_update_image. Pages are then made as immutable render target
+    // images, which D3D11 backs with a default usage texture that can be updated in place, and every upload to them
+    // goes through update_image_region
+    text_layer_update_image_region_fn update_image_region;
+    void*                             update_image_region_user_data;
+} text_layer_desc;
+
+// Counts for a single frame, or summed over the lifetime of the layer. Work done between calls to text_layer_draw()
+// counts towards the frame ended by the next call
+typedef struct text_layer_counters
+{
+    uint64_t glyphs_drawn;
+    uint64_t glyphs_dropped;
+    uint64_t glyph_cache_hits;
+    uint64_t glyph_cache_misses;
+    uint64_t glyphs_rasterized;
+    uint64_t shared_glyph_hits; // Glyph cache misses copied from another TextLayer's rasters instead of rastered
+    uint64_t shape_cache_hits;
+    uint64_t shape_cache_misses;
+    uint64_t evicted_pages;
+    uint64_t evicted_glyphs;
+    uint64_t grown_pages;
+    uint64_t atlas_compactions;
+    uint64_t atlas_bytes_uploaded;
+    uint64_t buffer_bytes_uploaded;
+    uint64_t draw_calls;
+
+    // Nanoseconds
+    uint64_t shape_time;
+    uint64_t raster_time; // Includes packing. With raster threads, only packing is timed
+    uint64_t draw_text_time; // Everything in text_layer_draw_text(), including shaping and rastering
+    uint64_t draw_time;
+} text_layer_counters;
+
+typedef struct text_layer_stats
+{
+    int      atlas_pages;
+    int      large_glyph_pages; // Of atlas_pages, the ones large glyphs are packed into
+    uint64_t atlas_bytes;       // GPU memory used by the atlas pages
+    uint64_t atlas_glyph_bytes; // Bytes of atlas_bytes covered by cached glyphs, padding included
+    int      shape_cache_entries;
+
+    text_layer_counters last_frame;
+    text_layer_counters total;
+} text_layer_stats;
+
+typedef struct text_layer_compact_result
+{
+    int      pages_before;
+    int      pages_after;
+    uint64_t bytes_before;
+    uint64_t bytes_after;
+    int      glyphs_moved;
+    int      glyphs_dropped; // Not drawn recently, so they were evicted instead of moved
+} text_layer_compact_result;
+
+TextLayer* text_layer_new(const text_layer_desc* desc);
 void       text_layer_destroy(TextLayer* gui);
 
-void text_layer_prerender_ascii(TextLayer* gui, float font_size);
-void text_layer_draw_text(TextLayer* gui, const char* text_start, const char* text_end, int x, int y, float font_size);
+void text_layer_get_stats(TextLayer* gui, text_layer_stats* stats);
+
+// Loads another font, e.g. a bold, italic or monospace face. Every font shares the same atlas pages and draw batch.
+// Returns the default font if the file can't be loaded or TEXT_LAYER_MAX_FONTS is reached
+text_layer_font text_layer_add_font(TextLayer* gui, const char* font_path);
+// Appends a font to the fallback chain. Characters missing from the font passed to text_layer_draw_text() are drawn
+// with the first font in the chain that has them, in the order the fonts were added
+void text_layer_add_fallback_font(TextLayer* gui, text_layer_font font);
 
-// Handle all the buffer uploads etc
+// Call when the window moves to a display with a different scale. Glyphs are rastered again at the new density as
+// they're drawn, and bitmaps at the old density are evicted with the rest of the least recently used glyphs
+void text_layer_set_backing_scale(TextLayer* gui, float backing_scale);
+
+// Inclusive range of Unicode codepoints. A single codepoint is a range with first == last
+typedef struct text_layer_codepoint_range
+{
+    uint32_t first;
+    uint32_t last;
+} text_layer_codepoint_range;
+
+// Rasters the glyphs of every codepoint in ranges at every font size, so the first frames don't stall on glyph cache
+// misses. Codepoints missing from the font are skipped. The glyphs are packed together and each atlas page they fill
+// is uploaded once
+void text_layer_prerender(
+    TextLayer*                        gui,
+    text_layer_font                   font,
+    const text_layer_codepoint_range* ranges,
+    int                               num_ranges,
+    const float*                      font_sizes,
+    int                               num_sizes);
+
+// Repacks the glyphs drawn in the last few seconds into as few pages as they fit in, and frees the rest. Glyphs that
+// haven't been drawn for longer are dropped. Call between frames, with no text queued since text_layer_draw()
+text_layer_compact_result text_layer_compact_atlases(TextLayer* gui);
+
+void text_layer_draw_text(
+    TextLayer*      gui,
+    text_layer_font font,
+    const char*     text_start,
+    const char*     text_end,
+    int             x,
+    int             y,
+    float           font_size);
+
+// Handle all the buffer uploads etc. Bitmap glyphs are drawn with sampler, which should be nearest neighbour. Distance
+// field modes ignore it and use the layer's linear sampler
 void text_layer_draw(TextLayer* gui, sg_sampler sampler, int gui_width, int gui_height);
 
 #endif // TEXT_H
@@ -19,6 +236,8 @@ void text_layer_draw(TextLayer* gui, sg_sampler sampler, int gui_width, int gui_
 #undef TEXT_IMPL
 
 #include "common.h"
+#include "glyph_map.h"
+#include "msdf.h"
 
 #include <kb_text_shape.h>
 #include <stb_rect_pack.h>
@@ -28,6 +247,8 @@ void text_layer_draw(TextLayer* gui, sg_sampler sampler, int gui_width, int gui_
 // #include <xhl/array2.h>
 #include <xhl/debug.h>
 #include <xhl/files.h>
+#include <xhl/thread.h>
+#include <xhl/time.h>
 
 #if !defined(RASTER_STB_TRUETYPE) && !defined(RASTER_FREETYPE_SINGLECHANNEL) && !defined(RASTER_FREETYPE_MULTICHANNEL)
 // #define RASTER_STB_TRUETYPE
@@ -42,14 +263,29 @@ void text_layer_draw(TextLayer* gui, sg_sampler sampler, int gui_width, int gui_
 #if defined(RASTER_FREETYPE_SINGLECHANNEL) || defined(RASTER_FREETYPE_MULTICHANNEL)
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_MODULE_H
+#include FT_OUTLINE_H
 #endif
 
 #if defined(RASTER_STB_TRUETYPE)
 #include <stb_truetype.h>
 #endif
 
-#ifndef MAX_GLYPHS
-#define MAX_GLYPHS 128
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Initial capacity of the glyph storage buffer. It grows geometrically from here
+#ifndef TEXT_BUFFER_INITIAL_CAP
+#define TEXT_BUFFER_INITIAL_CAP 128
 #endif
 
 enum
@@ -75,31 +311,56 @@ enum
     PLATFORM_SG_PIXEL_FORMAT  = SG_PIXELFORMAT_R8,
 #endif
 
-// TODO: make this state and not an enum
+// Default for text_layer_desc.backing_scale
 #if defined(__APPLE__)
     PLATFORM_BACKING_SCALE_FACTOR = 2,
 #else
     PLATFORM_BACKING_SCALE_FACTOR = 1,
 #endif
 
-    ATLAS_SIZE_SHIFT   = 8,
-    ATLAS_WIDTH        = (1 << ATLAS_SIZE_SHIFT),
-    ATLAS_HEIGHT       = ATLAS_WIDTH,
-    ATLAS_ROW_STRIDE   = ATLAS_WIDTH * PLATFORM_TEXTURE_CHANNELS,
-    ATLAS_UINT16_SHIFT = (16 - ATLAS_SIZE_SHIFT),
+    // Atlas pages are square. They start at ATLAS_MIN_SIZE and double up to text_layer_desc.max_atlas_page_size
+    ATLAS_MIN_SIZE_SHIFT   = 7,
+    ATLAS_MIN_SIZE         = (1 << ATLAS_MIN_SIZE_SHIFT),
+    ATLAS_DEFAULT_MAX_SIZE = 256,
+    // Pages only grow past max_atlas_page_size to fit a single glyph, up to TEXT_LAYER_MAX_ATLAS_PAGE_SIZE
+    ATLAS_MAX_SIZE_SHIFT = 12,
+    // Default for text_layer_desc.large_glyph_size
+    ATLAS_DEFAULT_LARGE_GLYPH_SIZE = 32,
+    // Initial layer count of the atlas texture array
+    ATLAS_ARRAY_INITIAL_LAYERS = 4,
 
     RECTPACK_PADDING = 1,
+
+    // Font size distance fields are rastered at, and the distance in pixels they extend past the glyph outline
+    SDF_REFERENCE_SIZE = 32,
+    SDF_SPREAD         = 4,
+
+    // Number of frames a shaped run can go undrawn before it's dropped from the cache
+    SHAPE_CACHE_MAX_AGE = 120,
+    // Number of frames a glyph can go undrawn before atlas compaction drops it
+    ATLAS_COMPACT_MAX_AGE = 600,
 };
-_Static_assert((ATLAS_WIDTH << ATLAS_UINT16_SHIFT) == (1 << 16), "");
+// Glyphs are packed into pages of their size class. Each class has a current page
+enum
+{
+    ATLAS_CLASS_SMALL,
+    ATLAS_CLASS_LARGE, // Glyphs larger than text_layer_desc.large_glyph_size
+    ATLAS_NUM_CLASSES,
+};
+
+_Static_assert(TEXT_LAYER_MAX_ATLAS_PAGE_SIZE < (1 << 15), "Must fit atlas_rect and UNORM16 texcoords");
+_Static_assert(TEXT_LAYER_MAX_ATLAS_PAGE_SIZE == (1 << ATLAS_MAX_SIZE_SHIFT), "Must match ATLAS_MAX_SIZE_SHIFT");
+_Static_assert(TEXT_LAYER_MAX_FONTS <= 256 && TEXT_LAYER_MAX_SUBPIXEL_BINS <= 256, "Must fit atlas_rect_header");
 
 // Used to identify a unique glyph.
-// TODO: support multiple fonts
 union atlas_rect_header
 {
     struct
     {
-        uint32_t glyphid;
-        float    font_size;
+        uint16_t glyphid; // TrueType & OpenType glyph ids are 16 bit
+        uint8_t  subpixel_bin;
+        uint8_t  font_id;    // Index in TextLayer.fonts
+        float    pixel_size; // Font size in physical pixels, so the backing scale is part of the key
     };
     uint64_t data;
 };
@@ -110,380 +371,2654 @@ typedef struct atlas_rect_t
 
     int16_t x, y, w, h;
 
+    // Bitmap offset from the pen, in physical pixels
     int16_t pen_offset_x;
     int16_t pen_offset_y;
 
+    // Index in glyph_atlases. -1 if the rect was evicted and the slot is free
+    int16_t  atlas_idx;
+    uint32_t last_used_frame;
+
     sg_view img_view;
 } atlas_rect;
-_Static_assert(ATLAS_WIDTH <= (1llu << 16), "");
 
 typedef struct glyph_atlas
 {
-    sg_view img_view;
-    bool    dirty;
-    bool    full;
+    sg_view  img_view;
+    int      size_shift; // The page is 1 << size_shift pixels wide and high
+    int      size_class; // ATLAS_CLASS_*. Pages loaded from the cache file are small
+    uint32_t last_used_frame;
+    bool     dirty;
+    bool     full;
+    // Copy of the page once it's full, for atlas compaction and the cache file. Texture array layers are already
+    // kept in atlas_array.pixels, so this is NULL for them unless the page was loaded from the cache file
+    unsigned char* pixels;
 } glyph_atlas;
 
-struct TextLayer
+// Region of a texture array layer written since the layer was last uploaded. Empty when x1 is 0
+typedef struct atlas_layer_region
 {
+    int x0, y0, x1, y1;
+} atlas_layer_region;
 
-    glyph_atlas* glyph_atlases;
-    atlas_rect*  rects;
+// Free area of a page, for TEXT_LAYER_PACKER_MAXRECTS. Free areas overlap, as each is as large as it can be
+typedef struct atlas_free_rect
+{
+    int x, y, w, h;
+} atlas_free_rect;
 
-    struct
-    {
-        int            idx;
-        stbrp_context  ctx;
-        stbrp_node*    nodes;
-        unsigned char* img_data;
-    } current_atlas;
+// Segment of the skyline for the skyline packers. It spans from x to the next segment, or to the right edge
+typedef struct atlas_skyline_node
+{
+    int x, y; // y is the first free row
+} atlas_skyline_node;
 
-    void*  fontdata;
-    size_t fontdata_size;
+// Row of glyphs for TEXT_LAYER_PACKER_SHELF
+typedef struct atlas_shelf
+{
+    int y, h;
+    int x; // Width used so far
+} atlas_shelf;
 
-#ifdef RASTER_FREETYPE
-    FT_Library ft_lib;
-    FT_Face    ft_face;
+// Places rects in a page. Every kind of packer takes stbrp_rect, and can grow with its page while keeping the rects
+// already placed
+typedef struct atlas_packer
+{
+    text_layer_packer kind;
+    int               width, height;
+
+    // Skyline packers. Ordered left to right
+    atlas_skyline_node* skyline;
+    // TEXT_LAYER_PACKER_MAXRECTS
+    atlas_free_rect* free_rects;
+    // TEXT_LAYER_PACKER_SHELF. Ordered top to bottom
+    atlas_shelf* shelves;
+} atlas_packer;
+
+// The page a size class is packing glyphs into
+typedef struct current_atlas
+{
+    int            idx; // Index in glyph_atlases. -1 until the class packs its first glyph
+    atlas_packer   packer;
+    unsigned char* img_data;
+    int            row_stride;
+
+    // Union of all regions written to img_data since the last upload. Only valid when the atlas is dirty
+    int dirty_x0, dirty_y0, dirty_x1, dirty_y1;
+    // No glyphs were packed since the page was made or recycled
+    bool empty;
+} current_atlas;
+
+// Atlas cache file layout: atlas_cache_header, uint64_t font_hashes[num_fonts], atlas_cache_rect rects[num_rects],
+// uint32_t page_sizes[num_pages], then the pages, each page_size * page_size * atlas_channels bytes
+enum
+{
+    ATLAS_CACHE_MAGIC   = 0x43414c54, // "TLAC"
+    ATLAS_CACHE_VERSION = 3,
+#if defined(RASTER_FREETYPE_SINGLECHANNEL)
+    ATLAS_CACHE_RASTERIZER = 1,
+#elif defined(RASTER_FREETYPE_MULTICHANNEL)
+    ATLAS_CACHE_RASTERIZER = 2,
+#else
+    ATLAS_CACHE_RASTERIZER = 3,
 #endif
+};
+
+typedef struct atlas_cache_header
+{
+    uint32_t magic;
+    uint32_t version;
+    // The file is ignored unless these match the TextLayer
+    uint32_t rasterizer;
+    uint32_t glyph_mode;
+    uint32_t atlas_channels;
+    uint32_t subpixel_bins;
+
+    uint32_t num_fonts;
+    uint32_t num_rects;
+    uint32_t num_pages;
+} atlas_cache_header;
+
+typedef struct atlas_cache_rect
+{
+    union atlas_rect_header header; // font_id indexes the file's font hashes
+
+    int16_t x, y, w, h;
+    int16_t pen_offset_x;
+    int16_t pen_offset_y;
 
+    // Page in the file. Index in glyph_atlases once loaded
+    int16_t atlas_idx;
+    int16_t padding;
+} atlas_cache_rect;
+
+typedef struct shaped_glyph
+{
+    uint16_t id;
+    uint16_t font_id; // Differs from the run's font when the glyph came from a fallback font
+    // Offset from the pen position. x is 26.6 fixed point so glyphs can be placed between pixels, y is whole pixels
+    int32_t x, y;
+} shaped_glyph;
+
+// Positioned glyphs of a string. Cached to skip shaping strings we drew recently
+typedef struct shaped_run
+{
+    uint64_t hash;
+
+    // Key
+    char*          text; // Not null terminated
+    int            text_len;
+    int            font_id;
+    float          font_size;
+    kbts_direction direction;
+    kbts_language  language;
+
+    uint32_t      last_used_frame;
+    shaped_glyph* glyphs;
+} shaped_run;
+
+typedef struct text_font
+{
+    // Index in g_text_shared.fonts
+    int shared_id;
+
+    // Copies of the shared font's fields
+    void*     fontdata;
+    size_t    fontdata_size;
+    uint64_t  hash;
+    kbts_font kb_font;
+#ifdef RASTER_FREETYPE
+    FT_Face ft_face;
+#endif
 #ifdef RASTER_STB_TRUETYPE
     stbtt_fontinfo fontinfo;
 #endif
+} text_font;
 
-    kbts_shape_context* kb_context;
+// Process wide font registry and CPU glyph cache, shared by every TextLayer. A plugin host can run dozens of
+// instances of a plugin in one process. Each instance still owns its shape context, FreeType faces and atlas pages,
+// since sokol_gfx state is per instance, but font files are loaded once and glyphs rastered by one instance are
+// copied by the others
+typedef struct shared_font
+{
+    char* path; // NULL when the slot is free
+    int   refcount;
 
-    // Text pipeline
-    sg_pipeline text_pip;
-    sg_buffer   text_sbo;
-    sg_view     text_sbv;
-    sg_sampler  text_smp;
+    void*  fontdata;
+    size_t fontdata_size;
+    // fontdata is a read only view of the font file rather than a heap copy
+    bool fontdata_mapped;
+    // Identifies the font contents in atlas cache files
+    uint64_t hash;
 
-    size_t        text_buffer_len;
-    text_buffer_t text_buffer[MAX_GLYPHS];
-};
+    // Read only once loaded, so every instance shapes with it directly
+    kbts_font kb_font;
+} shared_font;
 
-glyph_atlas glyph_atlas_new()
+typedef struct shared_glyph
 {
-    sg_image img = sg_make_image(&(sg_image_desc){
-        .width                = ATLAS_WIDTH,
-        .height               = ATLAS_HEIGHT,
-        .pixel_format         = PLATFORM_SG_PIXEL_FORMAT,
-        .usage.dynamic_update = true,
-    });
-    xassert(img.id);
-    glyph_atlas atlas = {.img_view = sg_make_view(&(sg_view_desc){.texture.image = img})};
-    xassert(atlas.img_view.id);
-    return atlas;
-}
+    // atlas_rect_header.data, with the font id of the registry and the subpixel bin in 1/TEXT_LAYER_MAX_SUBPIXEL_BINS
+    uint64_t key;
+    int      glyph_mode;
 
-#ifdef RASTER_FREETYPE
-int raster_glyph(TextLayer* gui, uint32_t glyph_index, float font_size)
-{
-    int num_packed = 0;
+    // Tightly packed, in the atlas pixel format of the glyph mode
+    unsigned char* bitmap;
+    int            width, rows, channels;
+    int            bitmap_left, bitmap_top;
+} shared_glyph;
 
-    xassert(gui->current_atlas.idx < xarr_len(gui->glyph_atlases));
-    glyph_atlas* atlas = gui->glyph_atlases + gui->current_atlas.idx;
+enum
+{
+    // Must fit in atlas_rect_header.font_id
+    SHARED_MAX_FONTS = 64,
+};
 
-    // const float DPI = 96;
-    // FT_Set_Char_Size(gui->ft_face, 0, font_size * 64 * PLATFORM_BACKING_SCALE_FACTOR, DPI, DPI);
-    FT_Set_Pixel_Sizes(gui->ft_face, 0, font_size * PLATFORM_BACKING_SCALE_FACTOR);
+// Bitmap bytes kept in the shared glyph cache. The oldest glyphs are evicted when it's full
+#ifndef TEXT_LAYER_SHARED_GLYPH_CACHE_SIZE
+#define TEXT_LAYER_SHARED_GLYPH_CACHE_SIZE (16 << 20)
+#endif
 
-    int err = FT_Load_Glyph(gui->ft_face, glyph_index, FT_LOAD_DEFAULT);
-    xassert(!err);
+static struct
+{
+    // Guards everything below
+    xmutex_t lock;
 
-    FT_GlyphSlot glyph = gui->ft_face->glyph;
+    shared_font fonts[SHARED_MAX_FONTS];
+    int         num_fonts; // Slots in use
 
-    FT_Render_Mode render_mode = PLATFORM_FT_RENDER_MODE;
-    FT_Render_Glyph(glyph, render_mode);
+    shared_glyph* glyphs;
+    // Maps shared_glyph.key to an index in glyphs, per glyph mode
+    glyph_map glyph_maps[TEXT_LAYER_GLYPH_MSDF + 1];
+    size_t    glyph_bytes;
+} g_text_shared = {.lock = XMUTEX_INIT};
 
-    const FT_Bitmap* bmp = &glyph->bitmap;
-    xassert(bmp->pixel_mode == PLATFORM_FT_PIXEL_MODE);
-    xassert((bmp->width % PLATFORM_FT_BITMAP_WIDTH) == 0); // note: FT width is measured in bytes (subpixels)
+// A glyph rastered to its own bitmap, before packing. Used by the raster workers and text_layer_prerender()
+typedef struct raster_job
+{
+    union atlas_rect_header header;
 
-    // Note all glyphs have height/rows... (spaces?)
-    if (bmp->width && bmp->rows)
-    {
-        int        width_pixels = bmp->width / PLATFORM_FT_BITMAP_WIDTH;
-        stbrp_rect rect         = {.w = width_pixels + RECTPACK_PADDING, .h = bmp->rows + RECTPACK_PADDING};
-        num_packed              = stbrp_pack_rects(&gui->current_atlas.ctx, &rect, 1);
+    // Filled in by render_raster_job(). bitmap is tightly packed, width pixels of channels bytes per row. NULL for
+    // glyphs without a bitmap (spaces)
+    unsigned char* bitmap;
+    int            width, rows, channels;
+    int            bitmap_left, bitmap_top;
+} raster_job;
 
-        if (num_packed == 0) // atlas is full
-        {
-            atlas->full = true;
+#ifdef RASTER_FREETYPE
+typedef struct raster_worker
+{
+    struct TextLayer* gui;
+    xthread_t         thread;
+    // FreeType faces can't be shared between threads. Every worker opens its own on the shared fontdata, the first
+    // time it rasters a glyph from that font
+    FT_Library ft_lib;
+    FT_Face    ft_faces[TEXT_LAYER_MAX_FONTS];
+} raster_worker;
+#endif // RASTER_FREETYPE
 
-            sg_view_desc view_desc = sg_query_view_desc(atlas->img_view);
-            sg_update_image(
-                view_desc.texture.image,
-                &(sg_image_data){.mip_levels[0] = {gui->current_atlas.img_data, ATLAS_HEIGHT * ATLAS_ROW_STRIDE}});
-            atlas->dirty = false;
+struct TextLayer
+{
 
-            // Clear rectpack
-            memset(&gui->current_atlas.ctx, 0, sizeof(gui->current_atlas.ctx));
-            stbrp_init_target(
-                &gui->current_atlas.ctx,
-                ATLAS_WIDTH - RECTPACK_PADDING,
-                ATLAS_HEIGHT - RECTPACK_PADDING,
-                gui->current_atlas.nodes,
-                xarr_len(gui->current_atlas.nodes));
+    glyph_atlas* glyph_atlases;
+    atlas_rect*  rects;
+    // Maps atlas_rect_header.data to an index in rects
+    glyph_map rect_map;
+    // Indexes of evicted rects, reused before growing rects
+    int* free_rects;
 
-            rect       = (stbrp_rect){.w = width_pixels + RECTPACK_PADDING, .h = bmp->rows + RECTPACK_PADDING};
-            num_packed = stbrp_pack_rects(&gui->current_atlas.ctx, &rect, 1);
-            xassert(num_packed == 1);
+    text_layer_glyph_mode glyph_mode;
 
-            // make new atlas
-            glyph_atlas new_atlas = glyph_atlas_new();
-            xarr_push(gui->glyph_atlases, new_atlas);
-            gui->current_atlas.idx++;
+    float backing_scale;
 
-            atlas = gui->glyph_atlases + gui->current_atlas.idx;
-        }
+    int subpixel_bins;
+    int subpixel_shift; // log2(subpixel_bins)
 
-        if (num_packed)
-        {
-            atlas_rect arect;
-            arect.header.glyphid   = glyph_index;
-            arect.header.font_size = font_size;
-            arect.pen_offset_x     = glyph->bitmap_left / PLATFORM_BACKING_SCALE_FACTOR;
-            arect.pen_offset_y     = glyph->bitmap_top / PLATFORM_BACKING_SCALE_FACTOR;
-            arect.x                = rect.x + RECTPACK_PADDING;
-            arect.y                = rect.y + RECTPACK_PADDING;
-            arect.w                = width_pixels;
-            arect.h                = bmp->rows;
-            arect.img_view         = atlas->img_view;
-            xassert(arect.x + arect.w <= ATLAS_WIDTH);
-            xassert(arect.y + arect.h <= ATLAS_HEIGHT);
+    // Atlas page format. MSDF glyphs need RGBA8 pages even when bitmaps would be single channel
+    int             atlas_channels;
+    sg_pixel_format atlas_pixel_format;
+    int             max_atlas_size_shift;
+    int             large_glyph_size; // 0 when every glyph is small
 
-            xarr_push(gui->rects, arect);
+    int      max_atlas_pages;
+    float    atlas_compact_threshold;
+    uint32_t frame;
 
-            // println("Printing character \"%c\" to atlas at %dx%d", (char)codepoint, rect.x, rect.y);
+    // Counts for the frame in progress. Moved to last_frame_counters and added to total_counters in text_layer_draw()
+    text_layer_counters counters;
+    text_layer_counters last_frame_counters;
+    text_layer_counters total_counters;
 
-            for (int y = 0; y < bmp->rows; y++)
-            {
-#if defined(RASTER_FREETYPE_SINGLECHANNEL)
-                unsigned char* dst = gui->current_atlas.img_data + (arect.y + y) * ATLAS_ROW_STRIDE + arect.x;
-                unsigned char* src = bmp->buffer + y * bmp->pitch;
+    text_layer_update_image_region_fn update_image_region;
+    void*                             update_image_region_user_data;
 
-                unsigned char(*src_view)[512]  = (void*)src;
-                src_view                      += 0;
-                unsigned char(*dst_view)[512]  = (void*)dst;
-                dst_view                      += 0;
+#ifdef RASTER_FREETYPE
+    // Background rasterization. Unused when there are no workers
+    raster_worker* raster_workers; // xarr
+    int            max_rasters_per_frame;
+    // Guards raster_queue, raster_results and raster_quit
+    xmutex_t    raster_lock;
+    xcond_t     raster_wake;
+    bool        raster_quit;
+    raster_job* raster_queue;
+    raster_job* raster_results;
+    // Main thread only. Finished jobs waiting for this frame's packing budget
+    raster_job* raster_ready;
+    // Main thread only. Glyphs sent to the workers and not yet packed. Glyphs without a bitmap (spaces) stay here so
+    // they're never requested again
+    glyph_map raster_requested;
+#endif
 
-                memcpy(dst, src, width_pixels);
+    current_atlas current_atlases[ATLAS_NUM_CLASSES];
 
-                dst_view += 0;
-#else
-                unsigned char* dst = gui->current_atlas.img_data + (arect.y + y) * ATLAS_ROW_STRIDE +
-                                     arect.x * PLATFORM_TEXTURE_CHANNELS;
-                unsigned char* src = bmp->buffer + y * bmp->pitch;
+    // Pages are layers of atlas_array instead of separate images. The img_data of each current page then points at
+    // its layer
+    bool atlas_texture_array;
+    struct
+    {
+        sg_image       img;
+        sg_view        view;
+        int            num_layers;
+        unsigned char* pixels;
+        // One per layer. Uploaded from text_layer_draw(), as sokol allows a single update per image per frame
+        atlas_layer_region* dirty_regions;
+        bool                dirty;
+    } atlas_array;
+
+    // Fixed size, so raster workers can read fontdata while fonts are added
+    text_font fonts[TEXT_LAYER_MAX_FONTS];
+    int       num_fonts;
+
+    // Font ids, in order of preference
+    int fallback_fonts[TEXT_LAYER_MAX_FONTS];
+    int num_fallback_fonts;
+    // Coverage of blocks of 64 codepoints, one bit per codepoint. Filled in the first time a block is tested
+    uint64_t* coverage_masks;
+    // Maps font id << 32 | block index to an index in coverage_masks
+    glyph_map coverage_map;
+
+    // NULL when there's no atlas cache file
+    char* atlas_cache_path;
+    // Font hashes of the loaded cache file
+    uint64_t* cache_font_hashes;
+    // Rects loaded from the cache file whose font hasn't been added yet
+    atlas_cache_rect* pending_cache_rects;
+
+    // Copy of the shared cache glyph being packed, so it's packed without holding the shared cache lock
+    unsigned char* shared_bitmap;
 
-                for (int x = 0; x < width_pixels;
-                     x++, dst += PLATFORM_TEXTURE_CHANNELS, src += PLATFORM_FT_BITMAP_WIDTH)
-                {
-                    dst[0] = src[0];
-                    dst[1] = src[1];
-                    dst[2] = src[2];
-                    dst[3] = 0;
-                }
+#ifdef RASTER_FREETYPE
+    FT_Library     ft_lib;
+    FT_Render_Mode ft_render_mode;
 #endif
-            }
 
-            atlas->dirty = true;
-        }
-    }
+    kbts_shape_context* kb_context;
 
-    return num_packed;
-}
-#endif // RASTER_FREETYPE
-#ifdef RASTER_STB_TRUETYPE
-int raster_glyph(TextLayer* gui, uint32_t glyph_index, float font_size)
+    bool        disable_shape_cache;
+    shaped_run* shape_cache;
+    // Maps shaped_run.hash to an index in shape_cache
+    glyph_map  shape_cache_map;
+    shaped_run shape_scratch; // Used when the cache is disabled
+
+    // Text pipeline
+    sg_pipeline text_pip;
+    sg_buffer   text_sbo;
+    sg_view     text_sbv;
+    int         text_sbo_cap; // Number of text_buffer_t the SBO fits
+    sg_sampler  text_smp; // Linear sampler for distance field modes
+
+    int max_glyphs;
+
+    text_buffer_t* text_buffer;
+    // text_buffer bucketed by atlas page. This is what gets uploaded when a frame samples multiple pages
+    text_buffer_t* text_buffer_sorted;
+    // Offset of each atlas page in text_buffer_sorted. Has length num atlases + 1
+    int* atlas_quad_offsets;
+    // Views of pages replaced by a larger image. Destroyed after the next draw, as a draw earlier in the frame can
+    // still be using them
+    sg_view* retired_page_views;
+};
+
+// Bytes in a page 1 << size_shift pixels wide
+size_t atlas_page_bytes(const TextLayer* gui, int size_shift)
 {
-    int num_packed = 0;
+    return ((size_t)1 << (size_shift * 2)) * gui->atlas_channels;
+}
 
-    xassert(gui->current_atlas.idx < xarr_len(gui->glyph_atlases));
-    glyph_atlas* atlas = gui->glyph_atlases + gui->current_atlas.idx;
+void mark_atlas_layer_dirty(TextLayer* gui, int layer, int x, int y, int w, int h)
+{
+    atlas_layer_region* region = gui->atlas_array.dirty_regions + layer;
+    if (region->x1 == 0)
+    {
+        *region = (atlas_layer_region){x, y, x + w, y + h};
+    }
+    else
+    {
+        if (x < region->x0)
+            region->x0 = x;
+        if (y < region->y0)
+            region->y0 = y;
+        if (x + w > region->x1)
+            region->x1 = x + w;
+        if (y + h > region->y1)
+            region->y1 = y + h;
+    }
+    gui->atlas_array.dirty = true;
+}
 
-    int advanceWidth = 0, leftSideBearing = 0;
-    int ix0 = 0, iy0 = 0, ix1 = 0, iy1 = 0;
-    // TODO: figure out what I should be using here...
-    // TODO: figure out how to get rasterizer to match the same height as the text shaper
-    float scale_pixel_height = stbtt_ScaleForPixelHeight(&gui->fontinfo, font_size * PLATFORM_BACKING_SCALE_FACTOR);
-    // float scale_emtopixels = stbtt_ScaleForMappingEmToPixels(&gui->fontinfo, font_size *
-    // PLATFORM_BACKING_SCALE_FACTOR);
-    float scale = scale_pixel_height;
-    stbtt_GetGlyphHMetrics(&gui->fontinfo, glyph_index, &advanceWidth, &leftSideBearing);
-    stbtt_GetGlyphBitmapBox(&gui->fontinfo, glyph_index, scale, scale, &ix0, &iy0, &ix1, &iy1);
+// Makes room in the texture array for at least num_layers pages. Layer contents are kept, but the image is made
+// again, so every page and rect moves to the new view and every page is uploaded again
+void reserve_atlas_layers(TextLayer* gui, int num_layers)
+{
+    const int old_layers = gui->atlas_array.num_layers;
+    if (num_layers <= old_layers)
+        return;
+
+    int new_layers = old_layers ? old_layers * 2 : ATLAS_ARRAY_INITIAL_LAYERS;
+    while (new_layers < num_layers)
+        new_layers *= 2;
+    // Pages past the budget are only made when every page is in use this frame, so the budget is usually all we need.
+    // Once past it, keep doubling so the array isn't made again for every page
+    if (gui->max_atlas_pages > 0 && old_layers < gui->max_atlas_pages && new_layers > gui->max_atlas_pages)
+        new_layers = num_layers > gui->max_atlas_pages ? num_layers : gui->max_atlas_pages;
+
+    const size_t   page_size = atlas_page_bytes(gui, gui->max_atlas_size_shift);
+    unsigned char* pixels    = xcalloc(new_layers, page_size);
+    if (gui->atlas_array.pixels)
+    {
+        memcpy(pixels, gui->atlas_array.pixels, old_layers * page_size);
+        xfree(gui->atlas_array.pixels);
+    }
+    gui->atlas_array.pixels     = pixels;
+    gui->atlas_array.num_layers = new_layers;
+    xarr_setlen(gui->atlas_array.dirty_regions, new_layers);
+    memset(gui->atlas_array.dirty_regions, 0, sizeof(atlas_layer_region) * new_layers);
+    for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+        if (gui->current_atlases[i].idx >= 0)
+            gui->current_atlases[i].img_data = pixels + gui->current_atlases[i].idx * page_size;
+
+    if (gui->atlas_array.img.id)
+    {
+        sg_destroy_view(gui->atlas_array.view);
+        sg_destroy_image(gui->atlas_array.img);
+    }
+    const int     size = 1 << gui->max_atlas_size_shift;
+    sg_image_desc desc = {
+        .type         = SG_IMAGETYPE_ARRAY,
+        .width        = size,
+        .height       = size,
+        .num_slices   = new_layers,
+        .pixel_format = gui->atlas_pixel_format,
+    };
+    // Made like the page images in glyph_atlas_new()
+    if (gui->update_image_region)
+    {
+        desc.usage.immutable        = true;
+        desc.usage.color_attachment = true;
+    }
+    else
+    {
+        desc.usage.dynamic_update = true;
+    }
+    gui->atlas_array.img = sg_make_image(&desc);
+    xassert(gui->atlas_array.img.id);
+    gui->atlas_array.view = sg_make_view(&(sg_view_desc){.texture.image = gui->atlas_array.img});
+    xassert(gui->atlas_array.view.id);
+    for (int i = 0; i < xarr_len(gui->glyph_atlases); i++)
+        mark_atlas_layer_dirty(gui, i, 0, 0, size, size);
+
+    for (int i = 0; i < xarr_len(gui->glyph_atlases); i++)
+        gui->glyph_atlases[i].img_view = gui->atlas_array.view;
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+        if (gui->rects[i].img_view.id)
+            gui->rects[i].img_view = gui->atlas_array.view;
+}
 
-    int iw = ix1 - ix0;
-    int ih = iy1 - iy0;
+// Texture array layers are all the largest size, so size_shift only applies to separate images
+glyph_atlas glyph_atlas_new(TextLayer* gui, int size_shift)
+{
+    if (gui->atlas_texture_array)
+    {
+        reserve_atlas_layers(gui, xarr_len(gui->glyph_atlases) + 1);
+        return (glyph_atlas){.img_view = gui->atlas_array.view, .size_shift = gui->max_atlas_size_shift};
+    }
 
-    if (iw && ih)
+    sg_image_desc desc = {
+        .width        = 1 << size_shift,
+        .height       = 1 << size_shift,
+        .pixel_format = gui->atlas_pixel_format,
+    };
+    // sokol only replaces dynamic images whole, and D3D11 makes them with a usage that can't be updated in part
+    if (gui->update_image_region)
     {
-        stbrp_rect rect = {.w = iw + RECTPACK_PADDING, .h = ih + RECTPACK_PADDING};
-        num_packed      = stbrp_pack_rects(&gui->current_atlas.ctx, &rect, 1);
+        desc.usage.immutable        = true;
+        desc.usage.color_attachment = true;
+    }
+    else
+    {
+        desc.usage.dynamic_update = true;
+    }
+    sg_image img = sg_make_image(&desc);
+    xassert(img.id);
+    glyph_atlas atlas = {.img_view = sg_make_view(&(sg_view_desc){.texture.image = img}), .size_shift = size_shift};
+    xassert(atlas.img_view.id);
+    return atlas;
+}
 
-        if (num_packed == 0) // atlas is full
-        {
-            atlas->full = true;
+// CPU copy of a page. NULL for pages that were full before they had one, which can only happen to loaded pages
+const unsigned char* atlas_page_pixels(const TextLayer* gui, int idx)
+{
+    if (gui->atlas_texture_array)
+        return gui->atlas_array.pixels + idx * atlas_page_bytes(gui, gui->max_atlas_size_shift);
+    for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+        if (idx == gui->current_atlases[i].idx)
+            return gui->current_atlases[i].img_data;
+    return gui->glyph_atlases[idx].pixels;
+}
 
-            sg_view_desc view_desc = sg_query_view_desc(atlas->img_view);
-            sg_update_image(
-                view_desc.texture.image,
-                &(sg_image_data){.mip_levels[0] = {gui->current_atlas.img_data, ATLAS_HEIGHT * ATLAS_ROW_STRIDE}});
-            atlas->dirty = false;
+// Size class of a glyph bitmap. Sizes include the padding, so the threshold is what a glyph takes up in the page
+int glyph_size_class(const TextLayer* gui, int width, int rows)
+{
+    if (gui->large_glyph_size > 0 && (width > gui->large_glyph_size || rows > gui->large_glyph_size))
+        return ATLAS_CLASS_LARGE;
+    return ATLAS_CLASS_SMALL;
+}
 
-            // Clear rectpack
-            memset(&gui->current_atlas.ctx, 0, sizeof(gui->current_atlas.ctx));
-            stbrp_init_target(
-                &gui->current_atlas.ctx,
-                ATLAS_WIDTH,
-                ATLAS_HEIGHT,
-                gui->current_atlas.nodes,
-                xarr_len(gui->current_atlas.nodes));
+// Caches a rect in the page given by arect->atlas_idx
+void insert_atlas_rect(TextLayer* gui, atlas_rect* arect)
+{
+    arect->last_used_frame = gui->frame;
 
-            rect       = (stbrp_rect){.w = iw + RECTPACK_PADDING, .h = ih + RECTPACK_PADDING};
-            num_packed = stbrp_pack_rects(&gui->current_atlas.ctx, &rect, 1);
-            xassert(num_packed == 1);
+    int idx;
+    if (xarr_len(gui->free_rects))
+    {
+        idx = gui->free_rects[xarr_len(gui->free_rects) - 1];
+        xarr_setlen(gui->free_rects, xarr_len(gui->free_rects) - 1);
+        gui->rects[idx] = *arect;
+    }
+    else
+    {
+        idx = xarr_len(gui->rects);
+        xarr_push(gui->rects, *arect);
+    }
+    glyph_map_set(&gui->rect_map, arect->header.data, idx);
 
-            // make new atlas
-            glyph_atlas new_atlas = glyph_atlas_new();
-            xarr_push(gui->glyph_atlases, new_atlas);
-            gui->current_atlas.idx++;
+    gui->glyph_atlases[arect->atlas_idx].last_used_frame = gui->frame;
+}
 
-            atlas = gui->glyph_atlases + gui->current_atlas.idx;
-        }
+// Caches a rect in the current page of a size class
+void push_atlas_rect(TextLayer* gui, int size_class, atlas_rect* arect)
+{
+    arect->atlas_idx = gui->current_atlases[size_class].idx;
+    insert_atlas_rect(gui, arect);
+}
 
-        if (num_packed)
-        {
-            atlas_rect arect;
-            arect.header.glyphid   = glyph_index;
-            arect.header.font_size = font_size;
-            arect.pen_offset_x     = ix0 / PLATFORM_BACKING_SCALE_FACTOR;
-            arect.pen_offset_y     = -iy0 / PLATFORM_BACKING_SCALE_FACTOR;
-            arect.x                = rect.x;
-            arect.y                = rect.y;
-            arect.w                = iw;
-            arect.h                = ih;
-            arect.img_view         = atlas->img_view;
-            xassert(arect.x + arect.w <= ATLAS_WIDTH);
-            xassert(arect.y + arect.h <= ATLAS_HEIGHT);
+// Drops a cached glyph and frees its slot in rects
+void evict_atlas_rect(TextLayer* gui, int idx)
+{
+    atlas_rect* rect = gui->rects + idx;
+    glyph_map_remove(&gui->rect_map, rect->header.data);
+    memset(rect, 0, sizeof(*rect));
+    rect->atlas_idx = -1;
+    xarr_push(gui->free_rects, idx);
+    gui->counters.evicted_glyphs++;
+}
 
-            unsigned char* dst =
-                gui->current_atlas.img_data + rect.y * ATLAS_ROW_STRIDE + rect.x * PLATFORM_TEXTURE_CHANNELS;
+// Drops all glyphs cached in an atlas page. The caller is responsible for clearing the pixels
+void evict_atlas_rects(TextLayer* gui, int atlas_idx)
+{
+    const int num_rects = xarr_len(gui->rects);
+    for (int i = 0; i < num_rects; i++)
+        if (gui->rects[i].atlas_idx == atlas_idx)
+            evict_atlas_rect(gui, i);
+
+    // Cached glyphs of fonts that haven't been added go too
+    int num_pending = 0;
+    for (int i = 0; i < xarr_len(gui->pending_cache_rects); i++)
+        if (gui->pending_cache_rects[i].atlas_idx != atlas_idx)
+            gui->pending_cache_rects[num_pending++] = gui->pending_cache_rects[i];
+    xarr_setlen(gui->pending_cache_rects, num_pending);
+}
 
-            stbtt_MakeGlyphBitmap(&gui->fontinfo, dst, iw, ih, ATLAS_ROW_STRIDE, scale, scale, glyph_index);
+void atlas_packer_init(atlas_packer* packer, text_layer_packer kind)
+{
+    memset(packer, 0, sizeof(*packer));
+    packer->kind = kind;
+}
 
-            xarr_push(gui->rects, arect);
+void atlas_packer_free(atlas_packer* packer)
+{
+    xarr_free(packer->skyline);
+    xarr_free(packer->free_rects);
+    xarr_free(packer->shelves);
+}
 
-            atlas->dirty = true;
-        }
+// Starts over with an empty area
+void atlas_packer_reset(atlas_packer* packer, int width, int height)
+{
+    packer->width  = width;
+    packer->height = height;
+    switch (packer->kind)
+    {
+    case TEXT_LAYER_PACKER_SKYLINE_BL:
+    case TEXT_LAYER_PACKER_SKYLINE_BF:
+        xarr_setlen(packer->skyline, 0);
+        xarr_push(packer->skyline, ((atlas_skyline_node){0, 0}));
+        break;
+    case TEXT_LAYER_PACKER_MAXRECTS:
+        xarr_setlen(packer->free_rects, 0);
+        xarr_push(packer->free_rects, ((atlas_free_rect){0, 0, width, height}));
+        break;
+    case TEXT_LAYER_PACKER_SHELF:
+        xarr_setlen(packer->shelves, 0);
+        break;
     }
+}
 
-    // stbtt_MakeGlyphBitmap(&gui->fontinfo, output, outWidth, outHeight, outStride, scaleX, scaleY, glyph_index);
+// Lowest y a rect of width w can sit at with its left edge at x, which is inside segment first. waste is the area left
+// empty under the rect
+int skyline_min_y(const atlas_packer* packer, int first, int x, int w, int* waste)
+{
+    const atlas_skyline_node* skyline     = packer->skyline;
+    const int                 num_nodes   = xarr_len(skyline);
+    int                       min_y       = 0;
+    int                       visited     = 0;
+    int                       waste_area  = 0;
+    for (int i = first; i < num_nodes && skyline[i].x < x + w; i++)
+    {
+        const int next_x = i + 1 < num_nodes ? skyline[i + 1].x : packer->width;
+        if (skyline[i].y > min_y)
+        {
+            // Everything under the rect so far is now empty space below it
+            waste_area += visited * (skyline[i].y - min_y);
+            min_y       = skyline[i].y;
+            visited    += skyline[i].x < x ? next_x - x : next_x - skyline[i].x;
+        }
+        else
+        {
+            int under = next_x - skyline[i].x;
+            if (visited + under > w)
+                under = w - visited;
+            waste_area += under * (min_y - skyline[i].y);
+            visited    += under;
+        }
+    }
+    *waste = waste_area;
+    return min_y;
+}
 
-    return num_packed;
+// Same placement as stb_rect_pack's skyline heuristics. Bottom left takes the lowest spot, best fit the lowest spot
+// that wastes the least area, trying the rect against the left and the right edge of each segment
+bool skyline_place(atlas_packer* packer, stbrp_rect* rect)
+{
+    const int w = rect->w;
+    const int h = rect->h;
+    if (w > packer->width || h > packer->height)
+        return false;
+
+    const bool                best_fit  = packer->kind == TEXT_LAYER_PACKER_SKYLINE_BF;
+    const atlas_skyline_node* skyline   = packer->skyline;
+    const int                 num_nodes = xarr_len(skyline);
+    int                       best = -1, best_x = 0, best_y = 1 << 30, best_waste = 1 << 30;
+    for (int i = 0; i < num_nodes && skyline[i].x + w <= packer->width; i++)
+    {
+        int       waste;
+        const int y = skyline_min_y(packer, i, skyline[i].x, w, &waste);
+        if (best_fit ? y + h <= packer->height && (y < best_y || (y == best_y && waste < best_waste)) : y < best_y)
+        {
+            best       = i;
+            best_x     = skyline[i].x;
+            best_y     = y;
+            best_waste = waste;
+        }
+    }
+    if (best_fit)
+    {
+        // Right edge of the rect on the left edge of each segment, and on the right edge of the page
+        int node = 0;
+        for (int i = 0; i <= num_nodes; i++)
+        {
+            const int x = (i < num_nodes ? skyline[i].x : packer->width) - w;
+            if (x < 0)
+                continue;
+            while (node + 1 < num_nodes && skyline[node + 1].x <= x)
+                node++;
+            int       waste;
+            const int y = skyline_min_y(packer, node, x, w, &waste);
+            if (y + h <= packer->height && y <= best_y &&
+                (y < best_y || waste < best_waste || (waste == best_waste && x < best_x)))
+            {
+                best       = node;
+                best_x     = x;
+                best_y     = y;
+                best_waste = waste;
+            }
+        }
+    }
+    if (best == -1 || best_y + h > packer->height)
+        return false;
+    rect->x = best_x;
+    rect->y = best_y;
+
+    // The rect's top replaces the segments it covers. A segment sticking out on the right keeps its height
+    const int x1  = best_x + w;
+    int       end = best;
+    while (end < num_nodes && skyline[end].x < x1)
+        end++;
+    const int  right_y    = skyline[end - 1].y;
+    const bool keep_left  = skyline[best].x < best_x;
+    const bool keep_right = (end < num_nodes ? skyline[end].x : packer->width) > x1;
+    const int  first_new  = best + keep_left;
+    const int  num_new    = 1 + keep_right;
+    const int  num_tail   = num_nodes - end;
+    const int  new_len    = first_new + num_new + num_tail;
+    if (new_len > num_nodes)
+        xarr_setlen(packer->skyline, new_len);
+    memmove(packer->skyline + first_new + num_new, packer->skyline + end, sizeof(*skyline) * num_tail);
+    xarr_setlen(packer->skyline, new_len);
+    packer->skyline[first_new] = (atlas_skyline_node){best_x, best_y + h};
+    if (keep_right)
+        packer->skyline[first_new + 1] = (atlas_skyline_node){x1, right_y};
+    return true;
 }
-#endif
 
-// Get cached rect. Rasters the rect to an atlas if not already cached
-// TODO: also compare font id
-// TODO: use fallback fonts. This may require accepting utf32 codepoints to detect language
-const atlas_rect* get_glyph_rect(TextLayer* gui, uint32_t glyph_index, float font_size)
+bool free_rect_contains(const atlas_free_rect* a, const atlas_free_rect* b)
 {
-    const int num_rects = xarr_len(gui->rects);
+    return b->x >= a->x && b->y >= a->y && b->x + b->w <= a->x + a->w && b->y + b->h <= a->y + a->h;
+}
 
-    const union atlas_rect_header header = {.glyphid = glyph_index, .font_size = font_size};
+// Drops free areas that were split (w == 0) and free areas inside another. Only areas from first on are tested, as
+// none of the areas before them can be inside another
+void prune_free_rects(atlas_packer* packer, int first)
+{
+    atlas_free_rect* free_rects = packer->free_rects;
+    const int        num_free   = xarr_len(free_rects);
+    for (int i = first; i < num_free; i++)
+        for (int j = 0; j < num_free && free_rects[i].w; j++)
+            if (j != i && free_rects[j].w && free_rect_contains(free_rects + j, free_rects + i))
+                free_rects[i].w = 0;
+
+    int num_kept = 0;
+    for (int i = 0; i < num_free; i++)
+        if (free_rects[i].w)
+            free_rects[num_kept++] = free_rects[i];
+    xarr_setlen(packer->free_rects, num_kept);
+}
 
-    for (int j = 0; j < num_rects; j++)
+bool maxrects_place(atlas_packer* packer, stbrp_rect* rect)
+{
+    // Best short side fit, then best long side fit
+    int best = -1, best_short_side = 0, best_long_side = 0;
+    for (int i = 0; i < xarr_len(packer->free_rects); i++)
     {
-        if (gui->rects[j].header.data == header.data)
-            return gui->rects + j;
+        const atlas_free_rect* it = packer->free_rects + i;
+        if (rect->w > it->w || rect->h > it->h)
+            continue;
+        const int dw         = it->w - rect->w;
+        const int dh         = it->h - rect->h;
+        const int short_side = dw < dh ? dw : dh;
+        const int long_side  = dw < dh ? dh : dw;
+        if (best == -1 || short_side < best_short_side ||
+            (short_side == best_short_side && long_side < best_long_side))
+        {
+            best            = i;
+            best_short_side = short_side;
+            best_long_side  = long_side;
+        }
     }
+    if (best == -1)
+        return false;
 
-    int did_raster = raster_glyph(gui, glyph_index, font_size);
-    if (did_raster)
+    rect->x = packer->free_rects[best].x;
+    rect->y = packer->free_rects[best].y;
+
+    // Every free area the rect overlaps is replaced by the largest areas left on each side of the rect
+    const int num_free = xarr_len(packer->free_rects);
+    for (int i = 0; i < num_free; i++)
     {
-        xassert(num_rects + 1 == xarr_len(gui->rects));
-        return gui->rects + num_rects;
+        const atlas_free_rect it = packer->free_rects[i];
+        if (rect->x >= it.x + it.w || rect->x + rect->w <= it.x || rect->y >= it.y + it.h || rect->y + rect->h <= it.y)
+            continue;
+
+        if (rect->x > it.x)
+            xarr_push(packer->free_rects, ((atlas_free_rect){it.x, it.y, rect->x - it.x, it.h}));
+        if (rect->x + rect->w < it.x + it.w)
+            xarr_push(
+                packer->free_rects,
+                ((atlas_free_rect){rect->x + rect->w, it.y, it.x + it.w - rect->x - rect->w, it.h}));
+        if (rect->y > it.y)
+            xarr_push(packer->free_rects, ((atlas_free_rect){it.x, it.y, it.w, rect->y - it.y}));
+        if (rect->y + rect->h < it.y + it.h)
+            xarr_push(
+                packer->free_rects,
+                ((atlas_free_rect){it.x, rect->y + rect->h, it.w, it.y + it.h - rect->y - rect->h}));
+        packer->free_rects[i].w = 0;
     }
-
-    // Note: this stub has a texture view id of 0
-    // sokol_gfx should assert in debug mode when trying to bind a texture view with an id of 0
-    // In release it should skip all draws using that view. This is our desired behaviour
-    static const atlas_rect stub_rect = {0};
-    return &stub_rect;
+    // The areas split off are the only ones that can be inside another
+    prune_free_rects(packer, num_free);
+    return true;
 }
 
-void draw_glyph(TextLayer* gui, int pen_x, int pen_y, unsigned glyph_idx, float font_size)
+// Shelf height for a rect. Heights round up to an eighth of the next power of 2, so a row wastes at most about a
+// quarter of its height on glyphs of its class
+int shelf_height_class(int h)
 {
-    const atlas_rect* rect = get_glyph_rect(gui, glyph_idx, font_size);
+    int pow2 = 4;
+    while (pow2 < h)
+        pow2 *= 2;
+    const int step = pow2 / 8 > 4 ? pow2 / 8 : 4;
+    return (h + step - 1) / step * step;
+}
 
-    if (gui->text_buffer_len < ARRLEN(gui->text_buffer))
+bool shelf_place(atlas_packer* packer, stbrp_rect* rect)
+{
+    const int h   = shelf_height_class(rect->h);
+    int       top = 0;
+    for (int i = 0; i < xarr_len(packer->shelves); i++)
     {
-        uint32_t tex_l = rect->x;
-        uint32_t tex_t = rect->y;
-        uint32_t tex_r = rect->x + rect->w;
-        uint32_t tex_b = rect->y + rect->h;
-
-        xassert(tex_l >= 0 && tex_l < ATLAS_WIDTH);
-        xassert(tex_t >= 0 && tex_t < ATLAS_HEIGHT);
-        xassert(tex_r >= 0 && tex_r < ATLAS_WIDTH);
-        xassert(tex_b >= 0 && tex_b < ATLAS_HEIGHT);
-
-        // atlas coordinates to INT16 normalised texture coordinates
-        tex_l <<= ATLAS_UINT16_SHIFT;
-        tex_t <<= ATLAS_UINT16_SHIFT;
-        tex_r <<= ATLAS_UINT16_SHIFT;
-        tex_b <<= ATLAS_UINT16_SHIFT;
-        xassert(tex_l < (1 << 16));
-        xassert(tex_t < (1 << 16));
-        xassert(tex_r < (1 << 16));
-        xassert(tex_b < (1 << 16));
+        atlas_shelf* it = packer->shelves + i;
+        if (it->h == h && it->x + rect->w <= packer->width)
+        {
+            rect->x  = it->x;
+            rect->y  = it->y;
+            it->x   += rect->w;
+            return true;
+        }
+        top = it->y + it->h;
+    }
 
-        int glyph_left   = pen_x + (int)rect->pen_offset_x;
-        int glyph_top    = pen_y - (int)rect->pen_offset_y;
-        int glyph_right  = glyph_left + (int)rect->w / PLATFORM_BACKING_SCALE_FACTOR;
-        int glyph_bottom = glyph_top + (int)rect->h / PLATFORM_BACKING_SCALE_FACTOR;
+    // The last shelf can be shorter than its class
+    const int shelf_h = top + h <= packer->height ? h : packer->height - top;
+    if (rect->w > packer->width || rect->h > shelf_h)
+        return false;
+    xarr_push(packer->shelves, ((atlas_shelf){.y = top, .h = shelf_h, .x = rect->w}));
+    rect->x = 0;
+    rect->y = top;
+    return true;
+}
 
-        xassert(glyph_left < (1 << 16));
-        xassert(glyph_top < (1 << 16));
-        xassert(glyph_right < (1 << 16));
-        xassert(glyph_bottom < (1 << 16));
+// Tallest first, then widest, like stb_rect_pack
+int compare_rect_height(const void* a, const void* b)
+{
+    const stbrp_rect* ra = a;
+    const stbrp_rect* rb = b;
+    if (ra->h != rb->h)
+        return rb->h - ra->h;
+    return rb->w - ra->w;
+}
 
-        text_buffer_t* obj        = gui->text_buffer + gui->text_buffer_len;
-        obj->coord_topleft[0]     = glyph_left;
-        obj->coord_topleft[1]     = glyph_top;
-        obj->coord_bottomright[0] = glyph_right;
-        obj->coord_bottomright[1] = glyph_bottom;
-        obj->tex_topleft          = tex_l | (tex_t << 16);
-        obj->tex_bottomright      = tex_r | (tex_b << 16);
-        // obj->tex_topleft     = tex_t | (tex_l << 16);
-        // obj->tex_bottomright = tex_b | (tex_r << 16);
+// Packs as many rects as fit, tallest first, and sets was_packed on each. Returns 1 if every rect was packed, like
+// stbrp_pack_rects(). Unlike stbrp_pack_rects(), the rects are left sorted tallest first
+int atlas_packer_pack(atlas_packer* packer, stbrp_rect* rects, int num_rects)
+{
+    if (num_rects > 1)
+        qsort(rects, num_rects, sizeof(*rects), compare_rect_height);
 
-        gui->text_buffer_len++;
+    int all_packed = 1;
+    for (int i = 0; i < num_rects; i++)
+    {
+        stbrp_rect* rect = rects + i;
+        switch (packer->kind)
+        {
+        case TEXT_LAYER_PACKER_SKYLINE_BL:
+        case TEXT_LAYER_PACKER_SKYLINE_BF: rect->was_packed = skyline_place(packer, rect); break;
+        case TEXT_LAYER_PACKER_MAXRECTS: rect->was_packed = maxrects_place(packer, rect); break;
+        case TEXT_LAYER_PACKER_SHELF: rect->was_packed = shelf_place(packer, rect); break;
+        }
+        if (!rect->was_packed)
+            all_packed = 0;
     }
+    return all_packed;
 }
 
-TextLayer* text_layer_new(const char* font_path)
+// Makes the area larger, keeping the rects already placed. The new space is on the right and bottom
+void atlas_packer_grow(atlas_packer* packer, int width, int height)
+{
+    const int old_width  = packer->width;
+    const int old_height = packer->height;
+    xassert(width >= old_width && height >= old_height);
+
+    switch (packer->kind)
+    {
+    case TEXT_LAYER_PACKER_SKYLINE_BL:
+    case TEXT_LAYER_PACKER_SKYLINE_BF:
+    {
+        // The new columns on the right are empty. Space left in the old area stays usable, and the skyline already
+        // treats everything below the old bottom edge as free
+        if (width > old_width)
+            xarr_push(packer->skyline, ((atlas_skyline_node){old_width, 0}));
+        packer->width  = width;
+        packer->height = height;
+        break;
+    }
+    case TEXT_LAYER_PACKER_MAXRECTS:
+    {
+        // Free areas reaching the old right or bottom edge now reach the new one, and the new space is free
+        const int num_free = xarr_len(packer->free_rects);
+        for (int i = 0; i < num_free; i++)
+        {
+            atlas_free_rect* it = packer->free_rects + i;
+            if (it->x + it->w == old_width)
+                it->w = width - it->x;
+            if (it->y + it->h == old_height)
+                it->h = height - it->y;
+        }
+        xarr_push(packer->free_rects, ((atlas_free_rect){old_width, 0, width - old_width, height}));
+        xarr_push(packer->free_rects, ((atlas_free_rect){0, old_height, width, height - old_height}));
+        prune_free_rects(packer, 0);
+        packer->width  = width;
+        packer->height = height;
+        break;
+    }
+    case TEXT_LAYER_PACKER_SHELF:
+        // Shelves keep their place and get longer. New shelves open below the last one
+        packer->width  = width;
+        packer->height = height;
+        break;
+    }
+}
+
+void reset_current_atlas_packer(TextLayer* gui, current_atlas* cur)
+{
+    const int size = 1 << gui->glyph_atlases[cur->idx].size_shift;
+    // Leave space for padding on both edges, so texcoords never reach the page size (1 << 16 in UNORM16)
+    atlas_packer_reset(&cur->packer, size - RECTPACK_PADDING, size - RECTPACK_PADDING);
+}
+
+void mark_current_atlas_dirty(TextLayer* gui, current_atlas* cur, int x, int y, int w, int h)
+{
+    glyph_atlas* atlas = gui->glyph_atlases + cur->idx;
+    if (!atlas->dirty)
+    {
+        cur->dirty_x0 = x;
+        cur->dirty_y0 = y;
+        cur->dirty_x1 = x + w;
+        cur->dirty_y1 = y + h;
+        atlas->dirty  = true;
+    }
+    else
+    {
+        if (x < cur->dirty_x0)
+            cur->dirty_x0 = x;
+        if (y < cur->dirty_y0)
+            cur->dirty_y0 = y;
+        if (x + w > cur->dirty_x1)
+            cur->dirty_x1 = x + w;
+        if (y + h > cur->dirty_y1)
+            cur->dirty_y1 = y + h;
+    }
+}
+
+void upload_current_atlas(TextLayer* gui, current_atlas* cur)
+{
+    glyph_atlas* atlas = gui->glyph_atlases + cur->idx;
+    if (!atlas->dirty)
+        return;
+
+    // The page is already in its layer. Layers are uploaded in upload_atlas_array()
+    if (gui->atlas_texture_array)
+    {
+        mark_atlas_layer_dirty(
+            gui,
+            cur->idx,
+            cur->dirty_x0,
+            cur->dirty_y0,
+            cur->dirty_x1 - cur->dirty_x0,
+            cur->dirty_y1 - cur->dirty_y0);
+        atlas->dirty = false;
+        return;
+    }
+
+    sg_image img = sg_query_view_desc(atlas->img_view).texture.image;
+    if (gui->update_image_region)
+    {
+        const int x = cur->dirty_x0;
+        const int y = cur->dirty_y0;
+        const int w = cur->dirty_x1 - x;
+        const int h = cur->dirty_y1 - y;
+        xassert(x >= 0 && y >= 0 && w > 0 && h > 0);
+        xassert(x + w <= (1 << atlas->size_shift) && y + h <= (1 << atlas->size_shift));
+
+        const unsigned char* data = cur->img_data + y * cur->row_stride + x * gui->atlas_channels;
+        gui->update_image_region(img, 0, x, y, w, h, data, cur->row_stride, gui->update_image_region_user_data);
+        gui->counters.atlas_bytes_uploaded += w * h * gui->atlas_channels;
+    }
+    else
+    {
+        sg_update_image(
+            img,
+            &(sg_image_data){
+                .mip_levels[0] = {
+                    .ptr  = cur->img_data,
+                    .size = atlas_page_bytes(gui, atlas->size_shift),
+                }});
+        gui->counters.atlas_bytes_uploaded += atlas_page_bytes(gui, atlas->size_shift);
+        // sokol only allows a single image update per frame, so treat the upload as a use
+        atlas->last_used_frame = gui->frame;
+    }
+    atlas->dirty = false;
+}
+
+// sokol allows a single update per image per frame, so the texture array is only uploaded from text_layer_draw()
+void upload_atlas_array(TextLayer* gui)
+{
+    if (!gui->atlas_array.dirty)
+        return;
+
+    const size_t layer_bytes = atlas_page_bytes(gui, gui->max_atlas_size_shift);
+    if (gui->update_image_region)
+    {
+        const int row_stride = (1 << gui->max_atlas_size_shift) * gui->atlas_channels;
+        for (int i = 0; i < gui->atlas_array.num_layers; i++)
+        {
+            const atlas_layer_region* region = gui->atlas_array.dirty_regions + i;
+            if (region->x1 == 0)
+                continue;
+
+            const int            w    = region->x1 - region->x0;
+            const int            h    = region->y1 - region->y0;
+            const unsigned char* data = gui->atlas_array.pixels + i * layer_bytes + region->y0 * row_stride +
+                                        region->x0 * gui->atlas_channels;
+            gui->update_image_region(
+                gui->atlas_array.img,
+                i,
+                region->x0,
+                region->y0,
+                w,
+                h,
+                data,
+                row_stride,
+                gui->update_image_region_user_data);
+            gui->counters.atlas_bytes_uploaded += w * h * gui->atlas_channels;
+        }
+    }
+    else
+    {
+        const size_t size = gui->atlas_array.num_layers * layer_bytes;
+        sg_update_image(
+            gui->atlas_array.img,
+            &(sg_image_data){.mip_levels[0] = {.ptr = gui->atlas_array.pixels, .size = size}});
+        gui->counters.atlas_bytes_uploaded += size;
+    }
+    memset(gui->atlas_array.dirty_regions, 0, sizeof(atlas_layer_region) * gui->atlas_array.num_layers);
+    gui->atlas_array.dirty = false;
+}
+
+// Called when the current page of a size class is full, or the class has no page yet. Uploads the full page, then
+// either makes a new atlas page or, if we're at our page budget, recycles the least recently used page. Pages of the
+// same class are recycled first, so large glyphs churning through their pages leave the pages of small text alone.
+// Pages used during the current frame are never recycled, as quads already in the text buffer may be sampling them,
+// and neither are the current pages of other classes. If every page is in use, we exceed the budget rather than draw
+// the wrong glyphs.
+glyph_atlas* next_atlas_page(TextLayer* gui, int size_class)
+{
+    current_atlas* cur            = gui->current_atlases + size_class;
+    int            old_size_shift = -1;
+    if (cur->idx >= 0)
+    {
+        glyph_atlas* atlas = gui->glyph_atlases + cur->idx;
+        atlas->full        = true;
+
+        upload_current_atlas(gui, cur);
+
+        old_size_shift = atlas->size_shift;
+        if (!gui->atlas_texture_array)
+        {
+            // The page may have grown since it was last full
+            if (atlas->pixels)
+                xfree(atlas->pixels);
+            atlas->pixels = xmalloc(atlas_page_bytes(gui, old_size_shift));
+            memcpy(atlas->pixels, cur->img_data, atlas_page_bytes(gui, old_size_shift));
+        }
+    }
+
+    const int num_atlases = xarr_len(gui->glyph_atlases);
+    int       lru_idx     = -1;
+    if (gui->max_atlas_pages > 0 && num_atlases >= gui->max_atlas_pages)
+    {
+        for (int i = 0; i < num_atlases; i++)
+        {
+            const glyph_atlas* it     = gui->glyph_atlases + i;
+            bool               in_use = it->last_used_frame == gui->frame;
+            for (int c = 0; c < ATLAS_NUM_CLASSES; c++)
+                in_use |= c != size_class && gui->current_atlases[c].idx == i;
+            if (in_use)
+                continue;
+            if (lru_idx == -1)
+            {
+                lru_idx = i;
+                continue;
+            }
+
+            const glyph_atlas* lru      = gui->glyph_atlases + lru_idx;
+            const bool         it_same  = it->size_class == size_class;
+            const bool         lru_same = lru->size_class == size_class;
+            if (it_same != lru_same ? it_same : it->last_used_frame < lru->last_used_frame)
+                lru_idx = i;
+        }
+    }
+
+    if (lru_idx != -1)
+    {
+        evict_atlas_rects(gui, lru_idx);
+        gui->counters.evicted_pages++;
+        cur->idx = lru_idx;
+    }
+    else
+    {
+        // New pages start small. Recycled pages keep the size they grew to
+        glyph_atlas new_atlas = glyph_atlas_new(gui, ATLAS_MIN_SIZE_SHIFT);
+        xarr_push(gui->glyph_atlases, new_atlas);
+        cur->idx = num_atlases;
+    }
+
+    glyph_atlas* atlas      = gui->glyph_atlases + cur->idx;
+    const size_t page_bytes = atlas_page_bytes(gui, atlas->size_shift);
+    if (gui->atlas_texture_array)
+    {
+        cur->img_data = gui->atlas_array.pixels + cur->idx * page_bytes;
+    }
+    else if (atlas->size_shift != old_size_shift)
+    {
+        if (cur->img_data)
+            xfree(cur->img_data);
+        cur->img_data = xmalloc(page_bytes);
+    }
+    memset(cur->img_data, 0, page_bytes);
+    cur->row_stride = (1 << atlas->size_shift) * gui->atlas_channels;
+    reset_current_atlas_packer(gui, cur);
+    cur->empty = true;
+
+    atlas->size_class      = size_class;
+    atlas->full            = false;
+    atlas->dirty           = false;
+    atlas->last_used_frame = gui->frame;
+    // The page is either new or holds stale glyphs on the GPU, so its first upload must cover all of it
+    mark_current_atlas_dirty(gui, cur, 0, 0, 1 << atlas->size_shift, 1 << atlas->size_shift);
+    return atlas;
+}
+
+// Starts over with a single empty page, which becomes the current page of small glyphs. Large glyphs get their first
+// page when one is packed
+void start_atlas_pages(TextLayer* gui)
+{
+    xarr_setlen(gui->glyph_atlases, 0);
+    for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+        gui->current_atlases[i].idx = -1;
+    next_atlas_page(gui, ATLAS_CLASS_SMALL);
+}
+
+// Current page of a size class, made on first use
+current_atlas* use_current_atlas(TextLayer* gui, int size_class)
+{
+    if (gui->current_atlases[size_class].idx < 0)
+        next_atlas_page(gui, size_class);
+    return gui->current_atlases + size_class;
+}
+
+void destroy_retired_pages(TextLayer* gui)
+{
+    for (int i = 0; i < xarr_len(gui->retired_page_views); i++)
+    {
+        sg_image img = sg_query_view_desc(gui->retired_page_views[i]).texture.image;
+        sg_destroy_view(gui->retired_page_views[i]);
+        sg_destroy_image(img);
+    }
+    xarr_setlen(gui->retired_page_views, 0);
+}
+
+// Doubles the size of the current page. Glyphs keep their pixel positions, so cached rects stay valid and only the
+// texcoords of quads already drawn from the page this frame need scaling
+void grow_current_atlas(TextLayer* gui, current_atlas* cur)
+{
+    const int    idx   = cur->idx;
+    glyph_atlas* atlas = gui->glyph_atlases + idx;
+    xassert(!gui->atlas_texture_array);
+    xassert(atlas->size_shift < ATLAS_MAX_SIZE_SHIFT);
+
+    const int old_size   = 1 << atlas->size_shift;
+    const int new_size   = old_size * 2;
+    const int old_stride = cur->row_stride;
+    const int new_stride = new_size * gui->atlas_channels;
+
+    unsigned char* img_data = xcalloc(new_size, new_stride);
+    for (int y = 0; y < old_size; y++)
+        memcpy(img_data + y * new_stride, cur->img_data + y * old_stride, old_stride);
+    xfree(cur->img_data);
+    cur->img_data   = img_data;
+    cur->row_stride = new_stride;
+
+    // Images can't be resized. Queued quads refer to the page by index and pick up the new image when they're drawn
+    xarr_push(gui->retired_page_views, atlas->img_view);
+    atlas->img_view   = glyph_atlas_new(gui, atlas->size_shift + 1).img_view;
+    atlas->size_shift = atlas->size_shift + 1;
+
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+        if (gui->rects[i].atlas_idx == idx)
+            gui->rects[i].img_view = atlas->img_view;
+
+    // UNORM16 texcoords are relative to the page size. Halve both 16 bit halves
+    for (int i = 0; i < xarr_len(gui->text_buffer); i++)
+    {
+        text_buffer_t* obj = gui->text_buffer + i;
+        if (obj->page == idx)
+        {
+            obj->tex_topleft     = (obj->tex_topleft >> 1) & 0x7fff7fff;
+            obj->tex_bottomright = (obj->tex_bottomright >> 1) & 0x7fff7fff;
+        }
+    }
+
+    atlas_packer_grow(&cur->packer, new_size - RECTPACK_PADDING, new_size - RECTPACK_PADDING);
+
+    // The new image has never been uploaded
+    atlas->dirty           = false;
+    atlas->last_used_frame = gui->frame;
+    mark_current_atlas_dirty(gui, cur, 0, 0, new_size, new_size);
+    gui->counters.grown_pages++;
+}
+
+// Called when a glyph doesn't fit the current page of its size class. The page doubles until it reaches
+// max_atlas_page_size, then the next page is started. An empty page that still can't hold the glyph keeps doubling, so
+// the glyph gets a page of its own. Returns false once the page can't grow, as the glyph will never fit
+bool make_atlas_room(TextLayer* gui, int size_class)
+{
+    current_atlas*     cur   = gui->current_atlases + size_class;
+    const glyph_atlas* atlas = gui->glyph_atlases + cur->idx;
+    if (atlas->size_shift < gui->max_atlas_size_shift)
+        grow_current_atlas(gui, cur);
+    else if (!cur->empty)
+        next_atlas_page(gui, size_class);
+    else if (!gui->atlas_texture_array && atlas->size_shift < ATLAS_MAX_SIZE_SHIFT)
+        grow_current_atlas(gui, cur);
+    else
+        return false;
+    return true;
+}
+
+// Copies a glyph bitmap to a rect packed in the current atlas page of its size class and caches the rect. channels is
+// the number of bytes per pixel in buffer. It either matches the atlas, or is 3 for subpixel bitmaps going into an
+// RGBA8 atlas
+void place_glyph_bitmap(
+    TextLayer*              gui,
+    int                     size_class,
+    union atlas_rect_header header,
+    const stbrp_rect*       rect,
+    const unsigned char*    buffer,
+    int                     pitch,
+    int                     width,
+    int                     rows,
+    int                     channels,
+    int                     bitmap_left,
+    int                     bitmap_top)
+{
+    xassert(channels == gui->atlas_channels || (channels == 3 && gui->atlas_channels == 4));
+    current_atlas* cur = gui->current_atlases + size_class;
+
+    atlas_rect arect;
+    arect.header       = header;
+    arect.pen_offset_x = bitmap_left;
+    arect.pen_offset_y = bitmap_top;
+    arect.x            = rect->x + RECTPACK_PADDING;
+    arect.y            = rect->y + RECTPACK_PADDING;
+    arect.w            = width;
+    arect.h            = rows;
+    arect.img_view     = gui->glyph_atlases[cur->idx].img_view;
+    xassert(arect.x + arect.w <= (1 << gui->glyph_atlases[cur->idx].size_shift));
+    xassert(arect.y + arect.h <= (1 << gui->glyph_atlases[cur->idx].size_shift));
+
+    push_atlas_rect(gui, size_class, &arect);
+
+    for (int y = 0; y < rows; y++)
+    {
+        unsigned char*       dst = cur->img_data + (arect.y + y) * cur->row_stride + arect.x * gui->atlas_channels;
+        const unsigned char* src = buffer + y * pitch;
+
+        if (channels == gui->atlas_channels)
+        {
+            memcpy(dst, src, width * channels);
+        }
+        else
+        {
+            for (int x = 0; x < width; x++, dst += gui->atlas_channels, src += channels)
+            {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+                dst[3] = 0;
+            }
+        }
+    }
+
+    mark_current_atlas_dirty(gui, cur, arect.x, arect.y, arect.w, arect.h);
+    cur->empty = false;
+}
+
+// Packs a glyph bitmap into the current atlas page of its size class and caches its rect. See place_glyph_bitmap()
+int pack_glyph_bitmap(
+    TextLayer*              gui,
+    union atlas_rect_header header,
+    const unsigned char*    buffer,
+    int                     pitch,
+    int                     width,
+    int                     rows,
+    int                     channels,
+    int                     bitmap_left,
+    int                     bitmap_top)
+{
+    int num_packed = 0;
+
+    // Note all glyphs have height/rows... (spaces?)
+    if (width && rows)
+    {
+        stbrp_rect     rect       = {.w = width + RECTPACK_PADDING, .h = rows + RECTPACK_PADDING};
+        const int      size_class = glyph_size_class(gui, rect.w, rect.h);
+        current_atlas* cur        = use_current_atlas(gui, size_class);
+        num_packed                = atlas_packer_pack(&cur->packer, &rect, 1);
+
+        // Atlas is full. Grow it or move on to the next page until the glyph fits. Glyphs too big for any page are
+        // dropped
+        while (num_packed == 0 && make_atlas_room(gui, size_class))
+        {
+            rect       = (stbrp_rect){.w = width + RECTPACK_PADDING, .h = rows + RECTPACK_PADDING};
+            num_packed = atlas_packer_pack(&cur->packer, &rect, 1);
+        }
+
+        if (num_packed)
+            place_glyph_bitmap(
+                gui,
+                size_class,
+                header,
+                &rect,
+                buffer,
+                pitch,
+                width,
+                rows,
+                channels,
+                bitmap_left,
+                bitmap_top);
+    }
+
+    return num_packed;
+}
+
+// Maps the shared glyphs to their new indices after glyphs were removed. Call with the lock held
+void rebuild_shared_glyph_maps()
+{
+    for (int i = 0; i < ARRLEN(g_text_shared.glyph_maps); i++)
+        glyph_map_clear(&g_text_shared.glyph_maps[i]);
+    for (int i = 0; i < xarr_len(g_text_shared.glyphs); i++)
+    {
+        const shared_glyph* g = g_text_shared.glyphs + i;
+        glyph_map_set(&g_text_shared.glyph_maps[g->glyph_mode], g->key, i);
+    }
+}
+
+// Removes the glyphs of a font from the shared cache. Call with the lock held
+void purge_shared_glyphs(int font_id)
+{
+    int num_kept = 0;
+    for (int i = 0; i < xarr_len(g_text_shared.glyphs); i++)
+    {
+        shared_glyph*                 g      = g_text_shared.glyphs + i;
+        const union atlas_rect_header header = {.data = g->key};
+        if (header.font_id == font_id)
+        {
+            g_text_shared.glyph_bytes -= g->width * g->rows * g->channels;
+            xfree(g->bitmap);
+        }
+        else
+        {
+            g_text_shared.glyphs[num_kept++] = *g;
+        }
+    }
+    xarr_setlen(g_text_shared.glyphs, num_kept);
+    rebuild_shared_glyph_maps();
+}
+
+// Evicts the oldest shared glyphs until size more bytes fit. Evicts down to 3/4 of the cache size, so a full cache
+// isn't rebuilt for every glyph published after it. Call with the lock held
+void evict_shared_glyphs(size_t size)
+{
+    const size_t max_bytes  = TEXT_LAYER_SHARED_GLYPH_CACHE_SIZE;
+    const size_t low_bytes  = max_bytes - max_bytes / 4;
+    const int    num_glyphs = xarr_len(g_text_shared.glyphs);
+
+    // Glyphs are appended as they're published, so the oldest come first
+    int num_evicted = 0;
+    while (num_evicted < num_glyphs &&
+           (g_text_shared.glyph_bytes + size > max_bytes || g_text_shared.glyph_bytes > low_bytes))
+    {
+        shared_glyph* g            = g_text_shared.glyphs + num_evicted++;
+        g_text_shared.glyph_bytes -= g->width * g->rows * g->channels;
+        xfree(g->bitmap);
+    }
+    memmove(
+        g_text_shared.glyphs,
+        g_text_shared.glyphs + num_evicted,
+        (num_glyphs - num_evicted) * sizeof(*g_text_shared.glyphs));
+    xarr_setlen(g_text_shared.glyphs, num_glyphs - num_evicted);
+    rebuild_shared_glyph_maps();
+}
+
+// Key of a glyph in the shared cache. TextLayers number their fonts and subpixel bins differently
+uint64_t shared_glyph_key(TextLayer* gui, union atlas_rect_header header)
+{
+    header.font_id       = gui->fonts[header.font_id].shared_id;
+    header.subpixel_bin *= TEXT_LAYER_MAX_SUBPIXEL_BINS / gui->subpixel_bins;
+    return header.data;
+}
+
+// Packs a glyph another TextLayer has already rastered. Returns the number of glyphs packed
+int pack_shared_glyph(TextLayer* gui, union atlas_rect_header header)
+{
+    const uint64_t key = shared_glyph_key(gui, header);
+
+    // Only the copy is done under the lock. Packing can grow, recycle and upload atlas pages, which other TextLayers
+    // shouldn't have to wait for
+    shared_glyph g = {0};
+    xmutex_lock(&g_text_shared.lock);
+    const int idx = glyph_map_get(&g_text_shared.glyph_maps[gui->glyph_mode], key);
+    if (idx >= 0)
+    {
+        g                = g_text_shared.glyphs[idx];
+        const size_t len = g.width * g.rows * g.channels;
+        xarr_setlen(gui->shared_bitmap, len);
+        memcpy(gui->shared_bitmap, g.bitmap, len);
+    }
+    xmutex_unlock(&g_text_shared.lock);
+
+    if (idx < 0)
+        return 0;
+    return pack_glyph_bitmap(
+        gui,
+        header,
+        gui->shared_bitmap,
+        g.width * g.channels,
+        g.width,
+        g.rows,
+        g.channels,
+        g.bitmap_left,
+        g.bitmap_top);
+}
+
+// Copies a glyph that was just packed into a current atlas page to the shared cache. Reading it back from the page
+// works the same for every rasterizer and glyph mode
+void publish_shared_glyph(TextLayer* gui, union atlas_rect_header header)
+{
+    const int idx = glyph_map_get(&gui->rect_map, header.data);
+    if (idx < 0)
+        return;
+    const atlas_rect*    rect       = gui->rects + idx;
+    const unsigned char* pixels     = atlas_page_pixels(gui, rect->atlas_idx);
+    const int            row_stride = (1 << gui->glyph_atlases[rect->atlas_idx].size_shift) * gui->atlas_channels;
+
+    const size_t row_bytes = rect->w * gui->atlas_channels;
+    const size_t size      = row_bytes * rect->h;
+
+    shared_glyph g = {
+        .key         = shared_glyph_key(gui, header),
+        .glyph_mode  = gui->glyph_mode,
+        .bitmap      = xmalloc(size),
+        .width       = rect->w,
+        .rows        = rect->h,
+        .channels    = gui->atlas_channels,
+        .bitmap_left = rect->pen_offset_x,
+        .bitmap_top  = rect->pen_offset_y,
+    };
+    const unsigned char* src = pixels + rect->y * row_stride + rect->x * gui->atlas_channels;
+    for (int y = 0; y < rect->h; y++)
+        memcpy(g.bitmap + y * row_bytes, src + y * row_stride, row_bytes);
+
+    xmutex_lock(&g_text_shared.lock);
+    glyph_map* map = &g_text_shared.glyph_maps[g.glyph_mode];
+    // Another instance may have published it first
+    if (glyph_map_get(map, g.key) < 0 && size <= TEXT_LAYER_SHARED_GLYPH_CACHE_SIZE)
+    {
+        if (g_text_shared.glyph_bytes + size > TEXT_LAYER_SHARED_GLYPH_CACHE_SIZE)
+            evict_shared_glyphs(size);
+
+        glyph_map_set(map, g.key, xarr_len(g_text_shared.glyphs));
+        xarr_push(g_text_shared.glyphs, g);
+        g_text_shared.glyph_bytes += size;
+        g.bitmap                   = NULL;
+    }
+    xmutex_unlock(&g_text_shared.lock);
+
+    if (g.bitmap)
+        xfree(g.bitmap);
+}
+
+#ifdef RASTER_FREETYPE
+// Opens a FreeType library. Used by the main thread and each raster worker
+bool open_ft_library(TextLayer* gui, FT_Library* lib)
+{
+    int err = FT_Init_FreeType(lib);
+    xassert(!err);
+    if (err)
+        return false;
+
+    if (gui->ft_render_mode == FT_RENDER_MODE_SDF)
+    {
+        FT_Int spread = SDF_SPREAD;
+        err           = FT_Property_Set(*lib, "sdf", "spread", &spread);
+        xassert(!err);
+    }
+    return true;
+}
+
+// Opens a face on the shared fontdata
+bool open_ft_face(FT_Library lib, const text_font* font, FT_Face* face)
+{
+    int err = FT_New_Memory_Face(lib, font->fontdata, font->fontdata_size, 0, face);
+    xassert(!err);
+    return !err;
+}
+
+// Sets a font size in pixels. Unlike FT_Set_Pixel_Sizes, fractional sizes aren't truncated. At 72 DPI a point is a
+// pixel
+void set_ft_pixel_size(FT_Face face, float pixel_size)
+{
+    FT_Set_Char_Size(face, 0, (FT_F26Dot6)(pixel_size * 64 + 0.5f), 72, 72);
+}
+
+// Loads and renders a glyph at the given size into face->glyph, shifted right by x_shift (26.6 fixed point pixels).
+// Returns the bitmap, or NULL on failure
+const FT_Bitmap* render_glyph_bitmap(
+    FT_Face        face,
+    FT_Render_Mode render_mode,
+    uint32_t       glyph_index,
+    float          pixel_size,
+    FT_Pos         x_shift)
+{
+    set_ft_pixel_size(face, pixel_size);
+
+    int err = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
+    xassert(!err);
+    if (err)
+        return NULL;
+
+    if (x_shift && face->glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+        FT_Outline_Translate(&face->glyph->outline, x_shift, 0);
+    FT_Render_Glyph(face->glyph, render_mode);
+
+    const FT_Bitmap* bmp = &face->glyph->bitmap;
+    xassert(bmp->pixel_mode == (render_mode == FT_RENDER_MODE_SDF ? FT_PIXEL_MODE_GRAY : PLATFORM_FT_PIXEL_MODE));
+    return bmp;
+}
+
+// FT_Outline_Decompose callbacks. Outline coordinates are 26.6 fixed point pixels
+int ft_outline_move_to(const FT_Vector* to, void* user)
+{
+    msdf_move_to(user, to->x / 64.0f, to->y / 64.0f);
+    return 0;
+}
+int ft_outline_line_to(const FT_Vector* to, void* user)
+{
+    msdf_line_to(user, to->x / 64.0f, to->y / 64.0f);
+    return 0;
+}
+int ft_outline_conic_to(const FT_Vector* control, const FT_Vector* to, void* user)
+{
+    msdf_quad_to(user, control->x / 64.0f, control->y / 64.0f, to->x / 64.0f, to->y / 64.0f);
+    return 0;
+}
+int ft_outline_cubic_to(const FT_Vector* control1, const FT_Vector* control2, const FT_Vector* to, void* user)
+{
+    msdf_cubic_to(
+        user,
+        control1->x / 64.0f,
+        control1->y / 64.0f,
+        control2->x / 64.0f,
+        control2->y / 64.0f,
+        to->x / 64.0f,
+        to->y / 64.0f);
+    return 0;
+}
+
+// Loads a glyph outline at the given size and generates a multi-channel distance field from it. Returns an RGBA8
+// bitmap to free with xfree(), or NULL for glyphs without an outline (spaces)
+unsigned char* render_glyph_msdf(
+    FT_Face  face,
+    uint32_t glyph_index,
+    float    pixel_size,
+    int*     width,
+    int*     rows,
+    int*     bitmap_left,
+    int*     bitmap_top)
+{
+    set_ft_pixel_size(face, pixel_size);
+
+    int err = FT_Load_Glyph(face, glyph_index, FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP);
+    xassert(!err);
+    if (err || face->glyph->format != FT_GLYPH_FORMAT_OUTLINE)
+        return NULL;
+
+    static const FT_Outline_Funcs funcs = {
+        .move_to  = ft_outline_move_to,
+        .line_to  = ft_outline_line_to,
+        .conic_to = ft_outline_conic_to,
+        .cubic_to = ft_outline_cubic_to,
+    };
+    msdf_shape shape = {0};
+    FT_Outline_Decompose(&face->glyph->outline, &funcs, &shape);
+
+    unsigned char* msdf = msdf_generate(&shape, SDF_SPREAD, width, rows, bitmap_left, bitmap_top);
+    msdf_shape_free(&shape);
+    return msdf;
+}
+
+// Horizontal shift of a subpixel bin in 26.6 fixed point pixels
+FT_Pos subpixel_shift_26_6(TextLayer* gui, int subpixel_bin)
+{
+    return ((FT_Pos)subpixel_bin * 64) >> gui->subpixel_shift;
+}
+
+// Renders job->header with the given face into job->bitmap
+void render_raster_job(TextLayer* gui, FT_Face face, raster_job* job)
+{
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+    {
+        job->channels = 4;
+        job->bitmap   = render_glyph_msdf(
+            face,
+            job->header.glyphid,
+            job->header.pixel_size,
+            &job->width,
+            &job->rows,
+            &job->bitmap_left,
+            &job->bitmap_top);
+        return;
+    }
+
+    const FT_Bitmap* bmp = render_glyph_bitmap(
+        face,
+        gui->ft_render_mode,
+        job->header.glyphid,
+        job->header.pixel_size,
+        subpixel_shift_26_6(gui, job->header.subpixel_bin));
+    if (bmp && bmp->width && bmp->rows)
+    {
+        const int row_bytes = bmp->width;
+
+        job->channels    = PLATFORM_FT_BITMAP_WIDTH;
+        job->width       = row_bytes / PLATFORM_FT_BITMAP_WIDTH;
+        job->rows        = bmp->rows;
+        job->bitmap_left = face->glyph->bitmap_left;
+        job->bitmap_top  = face->glyph->bitmap_top;
+        job->bitmap      = xmalloc(row_bytes * job->rows);
+        for (int y = 0; y < job->rows; y++)
+            memcpy(job->bitmap + y * row_bytes, bmp->buffer + y * bmp->pitch, row_bytes);
+    }
+}
+
+int raster_glyph(TextLayer* gui, union atlas_rect_header header)
+{
+    FT_Face face = gui->fonts[header.font_id].ft_face;
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+    {
+        int            width = 0, rows = 0, left = 0, top = 0;
+        unsigned char* msdf  = render_glyph_msdf(face, header.glyphid, header.pixel_size, &width, &rows, &left, &top);
+        if (!msdf)
+            return 0;
+
+        int num_packed = pack_glyph_bitmap(gui, header, msdf, width * 4, width, rows, 4, left, top);
+        xfree(msdf);
+        return num_packed;
+    }
+
+    const FT_Bitmap* bmp = render_glyph_bitmap(
+        face,
+        gui->ft_render_mode,
+        header.glyphid,
+        header.pixel_size,
+        subpixel_shift_26_6(gui, header.subpixel_bin));
+    if (!bmp)
+        return 0;
+
+    return pack_glyph_bitmap(
+        gui,
+        header,
+        bmp->buffer,
+        bmp->pitch,
+        bmp->width / PLATFORM_FT_BITMAP_WIDTH,
+        bmp->rows,
+        PLATFORM_FT_BITMAP_WIDTH,
+        face->glyph->bitmap_left,
+        face->glyph->bitmap_top);
+}
+
+void raster_worker_run(void* arg)
+{
+    raster_worker* worker = arg;
+    TextLayer*     gui    = worker->gui;
+
+    xmutex_lock(&gui->raster_lock);
+    while (true)
+    {
+        while (!gui->raster_quit && xarr_len(gui->raster_queue) == 0)
+            xcond_wait(&gui->raster_wake, &gui->raster_lock);
+        if (gui->raster_quit)
+            break;
+
+        raster_job job = gui->raster_queue[xarr_len(gui->raster_queue) - 1];
+        xarr_setlen(gui->raster_queue, xarr_len(gui->raster_queue) - 1);
+        xmutex_unlock(&gui->raster_lock);
+
+        FT_Face* face = worker->ft_faces + job.header.font_id;
+        if (*face == NULL)
+            open_ft_face(worker->ft_lib, gui->fonts + job.header.font_id, face);
+
+        render_raster_job(gui, *face, &job);
+
+        xmutex_lock(&gui->raster_lock);
+        xarr_push(gui->raster_results, job);
+    }
+    xmutex_unlock(&gui->raster_lock);
+}
+
+// Queues a glyph cache miss for the raster workers, unless it's already been queued
+void request_raster(TextLayer* gui, union atlas_rect_header header)
+{
+    if (glyph_map_get(&gui->raster_requested, header.data) >= 0)
+        return;
+    glyph_map_set(&gui->raster_requested, header.data, 0);
+
+    xmutex_lock(&gui->raster_lock);
+    xarr_push(gui->raster_queue, ((raster_job){.header = header}));
+    xmutex_unlock(&gui->raster_lock);
+    xcond_signal(&gui->raster_wake);
+}
+
+// Packs glyphs finished by the raster workers into the atlas, up to max_rasters_per_frame. The rest wait for the next
+// frame
+void pack_raster_results(TextLayer* gui)
+{
+    xmutex_lock(&gui->raster_lock);
+    for (int i = 0; i < xarr_len(gui->raster_results); i++)
+        xarr_push(gui->raster_ready, gui->raster_results[i]);
+    xarr_setlen(gui->raster_results, 0);
+    xmutex_unlock(&gui->raster_lock);
+
+    const int num_ready   = xarr_len(gui->raster_ready);
+    int       num_done    = 0;
+    int       num_bitmaps = 0;
+    for (; num_done < num_ready; num_done++)
+    {
+        raster_job* job = gui->raster_ready + num_done;
+        if (job->bitmap == NULL)
+            continue;
+        if (gui->max_rasters_per_frame > 0 && num_bitmaps == gui->max_rasters_per_frame)
+            break;
+        num_bitmaps++;
+
+        glyph_map_remove(&gui->raster_requested, job->header.data);
+        // text_layer_prerender() may have rastered the glyph in the meantime
+        if (glyph_map_get(&gui->rect_map, job->header.data) < 0)
+        {
+            int did_pack = pack_glyph_bitmap(
+                gui,
+                job->header,
+                job->bitmap,
+                job->width * job->channels,
+                job->width,
+                job->rows,
+                job->channels,
+                job->bitmap_left,
+                job->bitmap_top);
+            if (did_pack)
+            {
+                gui->counters.glyphs_rasterized++;
+                publish_shared_glyph(gui, job->header);
+            }
+        }
+        xfree(job->bitmap);
+    }
+
+    memmove(gui->raster_ready, gui->raster_ready + num_done, sizeof(*gui->raster_ready) * (num_ready - num_done));
+    xarr_setlen(gui->raster_ready, num_ready - num_done);
+}
+#endif // RASTER_FREETYPE
+#ifdef RASTER_STB_TRUETYPE
+// Renders job->header into job->bitmap
+void render_raster_job(TextLayer* gui, raster_job* job)
+{
+    const union atlas_rect_header header      = job->header;
+    const stbtt_fontinfo*         fontinfo    = &gui->fonts[header.font_id].fontinfo;
+    const uint32_t                glyph_index = header.glyphid;
+    const float                   pixel_size  = header.pixel_size;
+    // Horizontal shift of the subpixel bin in pixels
+    const float shift_x = (float)header.subpixel_bin / gui->subpixel_bins;
+
+    // TODO: figure out what I should be using here...
+    // TODO: figure out how to get rasterizer to match the same height as the text shaper
+    float scale_pixel_height = stbtt_ScaleForPixelHeight(fontinfo, pixel_size);
+    // float scale_emtopixels = stbtt_ScaleForMappingEmToPixels(fontinfo, pixel_size);
+    float scale = scale_pixel_height;
+
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+    {
+        stbtt_vertex* verts     = NULL;
+        int           num_verts = stbtt_GetGlyphShape(fontinfo, glyph_index, &verts);
+
+        msdf_shape shape = {0};
+        for (int i = 0; i < num_verts; i++)
+        {
+            const stbtt_vertex* v = verts + i;
+            switch (v->type)
+            {
+            case STBTT_vmove:
+                msdf_move_to(&shape, v->x * scale, v->y * scale);
+                break;
+            case STBTT_vline:
+                msdf_line_to(&shape, v->x * scale, v->y * scale);
+                break;
+            case STBTT_vcurve:
+                msdf_quad_to(&shape, v->cx * scale, v->cy * scale, v->x * scale, v->y * scale);
+                break;
+            case STBTT_vcubic:
+                msdf_cubic_to(
+                    &shape,
+                    v->cx * scale,
+                    v->cy * scale,
+                    v->cx1 * scale,
+                    v->cy1 * scale,
+                    v->x * scale,
+                    v->y * scale);
+                break;
+            }
+        }
+        stbtt_FreeShape(fontinfo, verts);
+
+        job->channels = 4;
+        job->bitmap   = msdf_generate(
+            &shape,
+            SDF_SPREAD,
+            &job->width,
+            &job->rows,
+            &job->bitmap_left,
+            &job->bitmap_top);
+        msdf_shape_free(&shape);
+        return;
+    }
+
+    job->channels = 1;
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_SDF)
+    {
+        // The distance field is padded by SDF_SPREAD on every side. x0 & y0 are the offset of the padded bitmap
+        int            w = 0, h = 0, x0 = 0, y0 = 0;
+        unsigned char* sdf =
+            stbtt_GetGlyphSDF(fontinfo, scale, glyph_index, SDF_SPREAD, 128, 128.0f / SDF_SPREAD, &w, &h, &x0, &y0);
+        if (sdf && w && h)
+        {
+            job->width       = w;
+            job->rows        = h;
+            job->bitmap_left = x0;
+            job->bitmap_top  = -y0;
+            job->bitmap      = xmalloc(w * h);
+            memcpy(job->bitmap, sdf, w * h);
+        }
+        if (sdf)
+            stbtt_FreeSDF(sdf, NULL);
+        return;
+    }
+
+    int ix0 = 0, iy0 = 0, ix1 = 0, iy1 = 0;
+    stbtt_GetGlyphBitmapBoxSubpixel(fontinfo, glyph_index, scale, scale, shift_x, 0, &ix0, &iy0, &ix1, &iy1);
+    const int iw = ix1 - ix0;
+    const int ih = iy1 - iy0;
+    if (iw > 0 && ih > 0)
+    {
+        job->width       = iw;
+        job->rows        = ih;
+        job->bitmap_left = ix0;
+        job->bitmap_top  = -iy0;
+        job->bitmap      = xcalloc(1, iw * ih);
+        stbtt_MakeGlyphBitmapSubpixel(fontinfo, job->bitmap, iw, ih, iw, scale, scale, shift_x, 0, glyph_index);
+    }
+}
+
+int raster_glyph(TextLayer* gui, union atlas_rect_header header)
+{
+    raster_job job        = {.header = header};
+    int        num_packed = 0;
+
+    render_raster_job(gui, &job);
+    if (job.bitmap)
+    {
+        num_packed = pack_glyph_bitmap(
+            gui,
+            header,
+            job.bitmap,
+            job.width * job.channels,
+            job.width,
+            job.rows,
+            job.channels,
+            job.bitmap_left,
+            job.bitmap_top);
+        xfree(job.bitmap);
+    }
+    return num_packed;
+}
+#endif
+
+// Get cached rect. Rasters the rect to an atlas if not already cached
+const atlas_rect* get_glyph_rect(TextLayer* gui, int font_id, uint32_t glyph_index, float font_size, int subpixel_bin)
+{
+    // Glyphs are cached at their size in physical pixels. One distance field serves every font size and scale
+    const float pixel_size =
+        gui->glyph_mode == TEXT_LAYER_GLYPH_BITMAP ? font_size * gui->backing_scale : SDF_REFERENCE_SIZE;
+
+    // Note: this stub has a texture view id of 0
+    // sokol_gfx should assert in debug mode when trying to bind a texture view with an id of 0
+    // In release it should skip all draws using that view. This is our desired behaviour
+    static const atlas_rect stub_rect = {0};
+
+    const union atlas_rect_header header = {
+        .glyphid      = glyph_index,
+        .subpixel_bin = subpixel_bin,
+        .font_id      = font_id,
+        .pixel_size   = pixel_size,
+    };
+
+    int idx = glyph_map_get(&gui->rect_map, header.data);
+    if (idx >= 0)
+    {
+        atlas_rect* rect      = gui->rects + idx;
+        rect->last_used_frame = gui->frame;
+        xassert(rect->atlas_idx >= 0 && rect->atlas_idx < xarr_len(gui->glyph_atlases));
+        gui->glyph_atlases[rect->atlas_idx].last_used_frame = gui->frame;
+        gui->counters.glyph_cache_hits++;
+        return rect;
+    }
+    gui->counters.glyph_cache_misses++;
+
+    uint64_t raster_start = xtime_now_ns();
+    if (pack_shared_glyph(gui, header))
+    {
+        gui->counters.raster_time += xtime_now_ns() - raster_start;
+        gui->counters.shared_glyph_hits++;
+        idx = glyph_map_get(&gui->rect_map, header.data);
+        xassert(idx >= 0);
+        return gui->rects + idx;
+    }
+
+#ifdef RASTER_FREETYPE
+    if (xarr_len(gui->raster_workers))
+    {
+        request_raster(gui, header);
+        return &stub_rect;
+    }
+#endif
+
+    raster_start               = xtime_now_ns();
+    int did_raster             = raster_glyph(gui, header);
+    gui->counters.raster_time += xtime_now_ns() - raster_start;
+    if (did_raster)
+    {
+        gui->counters.glyphs_rasterized++;
+        publish_shared_glyph(gui, header);
+        idx = glyph_map_get(&gui->rect_map, header.data);
+        xassert(idx >= 0);
+        return gui->rects + idx;
+    }
+
+    return &stub_rect;
+}
+
+// pen_x is 26.6 fixed point, pen_y is whole GUI units
+void draw_glyph(TextLayer* gui, int font_id, int pen_x, int pen_y, unsigned glyph_idx, float font_size)
+{
+    // Round the pen to the nearest subpixel bin of a physical pixel. Distance fields are drawn at the exact position
+    // instead
+    const float scale        = gui->backing_scale;
+    int         subpixel_bin = 0;
+    int         pen_x_pixels = 0;
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_BITMAP)
+    {
+        const int pen_x_physical = lrintf(pen_x * scale);
+        const int pen_x_bins     = (pen_x_physical * gui->subpixel_bins + 32) >> 6;
+        subpixel_bin             = pen_x_bins & (gui->subpixel_bins - 1);
+        pen_x_pixels             = pen_x_bins >> gui->subpixel_shift;
+    }
+
+    const atlas_rect* rect = get_glyph_rect(gui, font_id, glyph_idx, font_size, subpixel_bin);
+
+    // Glyphs without a bitmap (spaces) or glyphs that failed to raster
+    if (rect->img_view.id == 0)
+        return;
+
+    if (gui->max_glyphs > 0 && xarr_len(gui->text_buffer) >= gui->max_glyphs)
+    {
+        gui->counters.glyphs_dropped++;
+    }
+    else
+    {
+        uint32_t tex_l = rect->x;
+        uint32_t tex_t = rect->y;
+        uint32_t tex_r = rect->x + rect->w;
+        uint32_t tex_b = rect->y + rect->h;
+
+        const int size_shift = gui->glyph_atlases[rect->atlas_idx].size_shift;
+        xassert(tex_l >= 0 && tex_l < (1 << size_shift));
+        xassert(tex_t >= 0 && tex_t < (1 << size_shift));
+        xassert(tex_r >= 0 && tex_r < (1 << size_shift));
+        xassert(tex_b >= 0 && tex_b < (1 << size_shift));
+
+        // atlas coordinates to INT16 normalised texture coordinates
+        tex_l <<= 16 - size_shift;
+        tex_t <<= 16 - size_shift;
+        tex_r <<= 16 - size_shift;
+        tex_b <<= 16 - size_shift;
+        xassert(tex_l < (1 << 16));
+        xassert(tex_t < (1 << 16));
+        xassert(tex_r < (1 << 16));
+        xassert(tex_b < (1 << 16));
+
+        float glyph_left, glyph_top, glyph_right, glyph_bottom;
+        if (gui->glyph_mode != TEXT_LAYER_GLYPH_BITMAP)
+        {
+            // Distance fields are rastered at SDF_REFERENCE_SIZE pixels, whatever the backing scale
+            const float sdf_scale = font_size / SDF_REFERENCE_SIZE;
+
+            glyph_left   = pen_x / 64.0f + rect->pen_offset_x * sdf_scale;
+            glyph_top    = pen_y - rect->pen_offset_y * sdf_scale;
+            glyph_right  = glyph_left + rect->w * sdf_scale;
+            glyph_bottom = glyph_top + rect->h * sdf_scale;
+        }
+        else
+        {
+            // Bitmaps are placed on physical pixel boundaries so they're sampled 1:1
+            const float pen_y_pixels = roundf(pen_y * scale);
+
+            glyph_left   = (pen_x_pixels + rect->pen_offset_x) / scale;
+            glyph_top    = (pen_y_pixels - rect->pen_offset_y) / scale;
+            glyph_right  = glyph_left + rect->w / scale;
+            glyph_bottom = glyph_top + rect->h / scale;
+        }
+
+        xassert(glyph_left < (1 << 16));
+        xassert(glyph_top < (1 << 16));
+        xassert(glyph_right < (1 << 16));
+        xassert(glyph_bottom < (1 << 16));
+
+        text_buffer_t obj        = {0};
+        obj.coord_topleft[0]     = glyph_left;
+        obj.coord_topleft[1]     = glyph_top;
+        obj.coord_bottomright[0] = glyph_right;
+        obj.coord_bottomright[1] = glyph_bottom;
+        obj.tex_topleft          = tex_l | (tex_t << 16);
+        obj.tex_bottomright      = tex_r | (tex_b << 16);
+        obj.page                 = rect->atlas_idx;
+        // obj.tex_topleft     = tex_t | (tex_l << 16);
+        // obj.tex_bottomright = tex_b | (tex_r << 16);
+
+        xarr_push(gui->text_buffer, obj);
+        gui->counters.glyphs_drawn++;
+    }
+}
+
+uint64_t hash_shaped_run_key(
+    const char*    text,
+    int            text_len,
+    int            font_id,
+    float          font_size,
+    kbts_direction direction,
+    kbts_language  language)
+{
+    // FNV-1a
+    uint64_t hash  = 0xcbf29ce484222325llu;
+    hash          ^= (unsigned)font_id;
+    hash          *= 0x100000001b3llu;
+    for (int i = 0; i < text_len; i++)
+    {
+        hash ^= (unsigned char)text[i];
+        hash *= 0x100000001b3llu;
+    }
+    union
+    {
+        float    f;
+        uint32_t u;
+    } size_bits = {.f = font_size};
+
+    hash ^= glyph_map_hash(((uint64_t)size_bits.u << 32) | ((uint64_t)direction << 24) | (uint64_t)language);
+    return glyph_map_hash(hash);
+}
+
+// Returns true if the font has a glyph for the codepoint. Caches kbts coverage tests for the whole block of 64
+// codepoints around it
+bool font_covers_codepoint(TextLayer* gui, int font_id, int codepoint)
+{
+    const uint64_t key = ((uint64_t)font_id << 32) | (uint32_t)(codepoint >> 6);
+
+    int idx = glyph_map_get(&gui->coverage_map, key);
+    if (idx < 0)
+    {
+        uint64_t   mask = 0;
+        kbts_font* font = &gui->fonts[font_id].kb_font;
+        for (int i = 0; i < 64; i++)
+        {
+            kbts_font_coverage_test test;
+            kbts_FontCoverageTestBegin(&test, font);
+            kbts_FontCoverageTestCodepoint(&test, (codepoint & ~63) | i);
+            if (kbts_FontCoverageTestEnd(&test))
+                mask |= 1llu << i;
+        }
+        idx = xarr_len(gui->coverage_masks);
+        xarr_push(gui->coverage_masks, mask);
+        glyph_map_set(&gui->coverage_map, key, idx);
+    }
+    return (gui->coverage_masks[idx] >> (codepoint & 63)) & 1;
+}
+
+// Pushes the run's font onto the shape context, along with the fallback fonts needed for characters it lacks.
+// kbts picks the topmost font covering each grapheme, so fallbacks go underneath in reverse order of preference.
+// Returns the number of fonts pushed
+int push_run_fonts(TextLayer* gui, const shaped_run* run)
+{
+    bool needed[TEXT_LAYER_MAX_FONTS] = {0};
+    if (gui->num_fallback_fonts)
+    {
+        for (int i = 0; i < run->text_len;)
+        {
+            kbts_decode decode  = kbts_DecodeUtf8(run->text + i, run->text_len - i);
+            i                  += decode.SourceCharactersConsumed ? decode.SourceCharactersConsumed : 1;
+            if (!decode.Valid || font_covers_codepoint(gui, run->font_id, decode.Codepoint))
+                continue;
+
+            for (int j = 0; j < gui->num_fallback_fonts; j++)
+            {
+                const int font_id = gui->fallback_fonts[j];
+                if (font_id != run->font_id && font_covers_codepoint(gui, font_id, decode.Codepoint))
+                {
+                    needed[j] = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    int num_pushed = 0;
+    for (int j = gui->num_fallback_fonts; j-- > 0;)
+    {
+        if (needed[j])
+        {
+            kbts_ShapePushFont(gui->kb_context, &gui->fonts[gui->fallback_fonts[j]].kb_font);
+            num_pushed++;
+        }
+    }
+    kbts_ShapePushFont(gui->kb_context, &gui->fonts[run->font_id].kb_font);
+    return num_pushed + 1;
+}
+
+// Maps a font shaped by kbts back to its id
+int get_kbts_font_id(TextLayer* gui, const kbts_font* kb_font, int default_id)
+{
+    for (int i = 0; i < gui->num_fonts; i++)
+        if (&gui->fonts[i].kb_font == kb_font)
+            return i;
+    return default_id;
+}
+
+// Scale from font units to 26.6 fixed point pixels, in 16.16 fixed point
+void get_font_unit_scale(TextLayer* gui, int font_id, float font_size, int* x_scale, int* y_scale)
+{
+#if defined(RASTER_FREETYPE)
+    FT_Face face = gui->fonts[font_id].ft_face;
+    set_ft_pixel_size(face, font_size);
+    *x_scale = face->size->metrics.x_scale;
+    *y_scale = face->size->metrics.y_scale;
+#endif
+#if defined(RASTER_STB_TRUETYPE)
+    // TODO: figure out hwo to scale with STB_TRUETYPE
+    *x_scale = 32768;
+    *y_scale = 32768;
+#endif
+}
+
+// Shapes the text and lays it out naively left to right. Positions are stored relative to the pen position given to
+// text_layer_draw_text
+void shape_text(TextLayer* gui, shaped_run* run)
+{
+    const uint64_t shape_start = xtime_now_ns();
+    xarr_setlen(run->glyphs, 0);
+
+    text_font* font       = gui->fonts + run->font_id;
+    const int  num_pushed = push_run_fonts(gui, run);
+
+    kbts_ShapeBegin(gui->kb_context, run->direction, run->language);
+    kbts_ShapeUtf8(gui->kb_context, run->text, run->text_len, KBTS_USER_ID_GENERATION_MODE_CODEPOINT_INDEX);
+    kbts_ShapeEnd(gui->kb_context);
+
+#if defined(RASTER_FREETYPE)
+    // The size metrics are only valid for the size last set on the face. Layout is in GUI units, so it doesn't depend
+    // on the backing scale
+    set_ft_pixel_size(font->ft_face, run->font_size);
+
+    const FT_Size_Metrics* FtSizeMetrics = &font->ft_face->size->metrics;
+
+    int max_font_height_pixels = (FtSizeMetrics->ascender - FtSizeMetrics->descender) >> 6;
+    int pen_y_offset           = max_font_height_pixels + (FtSizeMetrics->descender >> 6);
+#endif
+#if defined(RASTER_STB_TRUETYPE)
+    int ascent = 0, descent = 0, lineGap = 0;
+    stbtt_GetFontVMetrics(&font->fontinfo, &ascent, &descent, &lineGap);
+
+    int max_font_height_pixels = (ascent + descent) >> 6;
+    int pen_y_offset           = max_font_height_pixels + (descent >> 6);
+#endif
+
+    // Fonts can have different units per em, so the pen is kept in 26.6 fixed point pixels
+    kbts_run Run;
+    int64_t  PenX = 0, PenY = 0;
+    while (kbts_ShapeRun(gui->kb_context, &Run))
+    {
+        const int font_id = get_kbts_font_id(gui, Run.Font, run->font_id);
+        int       x_scale, y_scale;
+        get_font_unit_scale(gui, font_id, run->font_size, &x_scale, &y_scale);
+
+        kbts_glyph* Glyph;
+        while (kbts_GlyphIteratorNext(&Run.Glyphs, &Glyph))
+        {
+            const int64_t GlyphX = PenX + (((int64_t)Glyph->OffsetX * x_scale) >> 16);
+            const int64_t GlyphY = PenY + (((int64_t)Glyph->OffsetY * y_scale) >> 16);
+
+            shaped_glyph g = {
+                .id      = Glyph->Id,
+                .font_id = font_id,
+                .x       = GlyphX,
+                .y       = (GlyphY >> 6) + pen_y_offset,
+            };
+            xarr_push(run->glyphs, g);
+
+            PenX += ((int64_t)Glyph->AdvanceX * x_scale) >> 16;
+            PenY += ((int64_t)Glyph->AdvanceY * y_scale) >> 16;
+        }
+    }
+    for (int i = 0; i < num_pushed; i++)
+        kbts_ShapePopFont(gui->kb_context);
+    gui->counters.shape_time += xtime_now_ns() - shape_start;
+}
+
+void shaped_run_free(shaped_run* run)
+{
+    xfree(run->text);
+    xarr_free(run->glyphs);
+}
+
+// Returns the cached run for the text, shaping it on a miss
+const shaped_run* get_shaped_run(TextLayer* gui, int font_id, const char* text, int text_len, float font_size)
+{
+    const kbts_direction direction = KBTS_DIRECTION_DONT_KNOW;
+    const kbts_language  language  = KBTS_LANGUAGE_DONT_KNOW;
+
+    const uint64_t hash = hash_shaped_run_key(text, text_len, font_id, font_size, direction, language);
+
+    shaped_run* run = NULL;
+    int         idx = glyph_map_get(&gui->shape_cache_map, hash);
+    if (idx >= 0)
+    {
+        run = gui->shape_cache + idx;
+        if (run->text_len == text_len && run->font_id == font_id && run->font_size == font_size &&
+            run->direction == direction && run->language == language && memcmp(run->text, text, text_len) == 0)
+        {
+            run->last_used_frame = gui->frame;
+            gui->counters.shape_cache_hits++;
+            return run;
+        }
+        // Hash collision. Rare enough that we just replace the old run
+        xfree(run->text);
+    }
+    else
+    {
+        idx = xarr_len(gui->shape_cache);
+        xarr_push(gui->shape_cache, (shaped_run){0});
+        run = gui->shape_cache + idx;
+        glyph_map_set(&gui->shape_cache_map, hash, idx);
+    }
+    gui->counters.shape_cache_misses++;
+
+    run->hash      = hash;
+    run->text      = xmalloc(text_len);
+    run->text_len  = text_len;
+    run->font_id   = font_id;
+    run->font_size = font_size;
+    run->direction = direction;
+    run->language  = language;
+    memcpy(run->text, text, text_len);
+    run->last_used_frame = gui->frame;
+
+    shape_text(gui, run);
+    return run;
+}
+
+// Drops runs that haven't been drawn in a while
+void age_shape_cache(TextLayer* gui)
+{
+    for (int i = 0; i < xarr_len(gui->shape_cache);)
+    {
+        shaped_run* run = gui->shape_cache + i;
+        if (gui->frame - run->last_used_frame > SHAPE_CACHE_MAX_AGE)
+        {
+            glyph_map_remove(&gui->shape_cache_map, run->hash);
+            shaped_run_free(run);
+
+            // Swap remove
+            const int last = xarr_len(gui->shape_cache) - 1;
+            if (i != last)
+            {
+                *run = gui->shape_cache[last];
+                glyph_map_set(&gui->shape_cache_map, run->hash, i);
+            }
+            xarr_setlen(gui->shape_cache, last);
+        }
+        else
+        {
+            i++;
+        }
+    }
+}
+
+// (Re)creates the glyph storage buffer and its view
+void make_text_sbo(TextLayer* gui, int num_glyphs)
+{
+    if (gui->text_sbv.id)
+        sg_destroy_view(gui->text_sbv);
+    if (gui->text_sbo.id)
+        sg_destroy_buffer(gui->text_sbo);
+
+    gui->text_sbo_cap = num_glyphs;
+    gui->text_sbo     = sg_make_buffer(&(sg_buffer_desc){
+            .usage.storage_buffer = true,
+            .usage.stream_update  = true,
+            .size                 = sizeof(text_buffer_t) * num_glyphs,
+            .label                = "text SBO",
+    });
+    xassert(gui->text_sbo.id);
+    gui->text_sbv = sg_make_view(&(sg_view_desc){
+        .storage_buffer = gui->text_sbo,
+    });
+    xassert(gui->text_sbv.id);
+}
+
+// Loads the atlas pages saved by a previous session. Their glyphs become usable as their fonts are added
+void load_atlas_cache(TextLayer* gui)
+{
+    void*  data = NULL;
+    size_t size = 0;
+    if (!xfiles_exists(gui->atlas_cache_path) || !xfiles_read(gui->atlas_cache_path, &data, &size))
+        return;
+
+    const atlas_cache_header* hdr = data;
+
+    bool valid = size >= sizeof(*hdr) && hdr->magic == ATLAS_CACHE_MAGIC && hdr->version == ATLAS_CACHE_VERSION &&
+                 hdr->rasterizer == ATLAS_CACHE_RASTERIZER && hdr->glyph_mode == gui->glyph_mode &&
+                 hdr->atlas_channels == gui->atlas_channels && hdr->subpixel_bins == gui->subpixel_bins;
+    // Bound the counts by the file size before multiplying them, so a corrupt header can't overflow the offsets
+    const size_t max_table_bytes = valid ? size - sizeof(*hdr) : 0;
+    valid = valid && hdr->num_fonts <= max_table_bytes / sizeof(uint64_t) &&
+            hdr->num_rects <= max_table_bytes / sizeof(atlas_cache_rect) &&
+            hdr->num_pages <= max_table_bytes / sizeof(uint32_t);
+    const size_t pages_offset =
+        valid ? sizeof(*hdr) + hdr->num_fonts * sizeof(uint64_t) + hdr->num_rects * sizeof(atlas_cache_rect) +
+                    hdr->num_pages * sizeof(uint32_t)
+              : 0;
+    valid = valid && size >= pages_offset;
+
+    // Pages that don't fit a layer of this layer's texture array are rejected along with the rest of the file. Other
+    // pages can be larger than max_atlas_page_size, as a page grows past it to fit a single glyph
+    const uint32_t max_page_size =
+        gui->atlas_texture_array ? 1u << gui->max_atlas_size_shift : TEXT_LAYER_MAX_ATLAS_PAGE_SIZE;
+    const uint32_t* page_sizes =
+        valid ? (const uint32_t*)((const unsigned char*)data + pages_offset) - hdr->num_pages : NULL;
+    size_t file_size = pages_offset;
+    for (uint32_t i = 0; valid && i < hdr->num_pages; i++)
+    {
+        const uint32_t page_size = page_sizes[i];
+        valid = page_size >= ATLAS_MIN_SIZE && page_size <= max_page_size && (page_size & (page_size - 1)) == 0;
+        file_size += (size_t)page_size * page_size * gui->atlas_channels;
+        valid = valid && file_size <= size;
+    }
+    valid = valid && size == file_size;
+
+    if (valid)
+    {
+        const uint64_t*         font_hashes = (const uint64_t*)(hdr + 1);
+        const atlas_cache_rect* rects       = (const atlas_cache_rect*)(font_hashes + hdr->num_fonts);
+        const unsigned char*    pages       = (const unsigned char*)data + pages_offset;
+
+        // Leave room in the page budget for the current page
+        int num_pages = hdr->num_pages;
+        if (gui->max_atlas_pages > 0 && num_pages > gui->max_atlas_pages - 1)
+            num_pages = gui->max_atlas_pages - 1;
+
+        // Loaded pages are never packed into again, only recycled
+        const int first_page = xarr_len(gui->glyph_atlases);
+        for (int i = 0; i < num_pages; i++)
+        {
+            int size_shift = ATLAS_MIN_SIZE_SHIFT;
+            while ((1u << size_shift) < page_sizes[i])
+                size_shift++;
+
+            // A texture array layer can be larger than the saved page, which then fills its top left
+            glyph_atlas  atlas      = glyph_atlas_new(gui, size_shift);
+            const size_t page_size  = atlas_page_bytes(gui, atlas.size_shift);
+            const int    src_stride = page_sizes[i] * gui->atlas_channels;
+            const int    dst_stride = (1 << atlas.size_shift) * gui->atlas_channels;
+            atlas.full              = true;
+            if (!gui->atlas_texture_array)
+                atlas.pixels = xcalloc(1, page_size);
+            unsigned char* dst = gui->atlas_texture_array
+                                     ? gui->atlas_array.pixels + xarr_len(gui->glyph_atlases) * page_size
+                                     : atlas.pixels;
+            for (uint32_t y = 0; y < page_sizes[i]; y++)
+                memcpy(dst + y * dst_stride, pages + y * src_stride, src_stride);
+            pages += atlas_page_bytes(gui, size_shift);
+
+            if (gui->atlas_texture_array)
+            {
+                mark_atlas_layer_dirty(gui, xarr_len(gui->glyph_atlases), 0, 0, page_sizes[i], page_sizes[i]);
+            }
+            else
+            {
+                sg_image img = sg_query_view_desc(atlas.img_view).texture.image;
+                if (gui->update_image_region)
+                    gui->update_image_region(
+                        img,
+                        0,
+                        0,
+                        0,
+                        1 << atlas.size_shift,
+                        1 << atlas.size_shift,
+                        atlas.pixels,
+                        dst_stride,
+                        gui->update_image_region_user_data);
+                else
+                    sg_update_image(img, &(sg_image_data){.mip_levels[0] = {.ptr = atlas.pixels, .size = page_size}});
+                gui->counters.atlas_bytes_uploaded += page_size;
+            }
+            xarr_push(gui->glyph_atlases, atlas);
+        }
+
+        for (uint32_t i = 0; i < hdr->num_fonts; i++)
+            xarr_push(gui->cache_font_hashes, font_hashes[i]);
+
+        for (uint32_t i = 0; i < hdr->num_rects; i++)
+        {
+            atlas_cache_rect rect = rects[i];
+            if (rect.atlas_idx < 0 || rect.atlas_idx >= num_pages || rect.header.font_id >= hdr->num_fonts)
+                continue;
+            // The int16 fields are promoted to int, so x + w can't overflow
+            const int page_size = page_sizes[rect.atlas_idx];
+            if (rect.x >= 0 && rect.y >= 0 && rect.w >= 0 && rect.h >= 0 && rect.x + rect.w <= page_size &&
+                rect.y + rect.h <= page_size)
+            {
+                rect.atlas_idx += first_page;
+                xarr_push(gui->pending_cache_rects, rect);
+            }
+        }
+    }
+
+    XFILES_FREE(data);
+}
+
+// Makes the cached glyphs of a font that was just added usable
+void add_cached_rects(TextLayer* gui, int font_id)
+{
+    const uint64_t hash        = gui->fonts[font_id].hash;
+    int            num_pending = 0;
+    for (int i = 0; i < xarr_len(gui->pending_cache_rects); i++)
+    {
+        const atlas_cache_rect* it = gui->pending_cache_rects + i;
+        if (gui->cache_font_hashes[it->header.font_id] != hash)
+        {
+            gui->pending_cache_rects[num_pending++] = *it;
+            continue;
+        }
+
+        atlas_rect arect = {
+            .header       = it->header,
+            .x            = it->x,
+            .y            = it->y,
+            .w            = it->w,
+            .h            = it->h,
+            .pen_offset_x = it->pen_offset_x,
+            .pen_offset_y = it->pen_offset_y,
+            .atlas_idx    = it->atlas_idx,
+            .img_view     = gui->glyph_atlases[it->atlas_idx].img_view,
+        };
+        arect.header.font_id = font_id;
+        if (glyph_map_get(&gui->rect_map, arect.header.data) < 0)
+            insert_atlas_rect(gui, &arect);
+    }
+    xarr_setlen(gui->pending_cache_rects, num_pending);
+}
+
+// Writes the atlas pages holding glyphs, and the rects packed into them. Glyphs of fonts loaded from the previous file
+// but never added this session are dropped
+void save_atlas_cache(TextLayer* gui)
+{
+    // Index of each atlas page in the file, or -1 if it holds no glyphs
+    int* page_map = NULL;
+    xarr_setlen(page_map, xarr_len(gui->glyph_atlases));
+    for (int i = 0; i < xarr_len(page_map); i++)
+        page_map[i] = -1;
+
+    int num_rects = 0;
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+    {
+        if (gui->rects[i].atlas_idx >= 0)
+        {
+            page_map[gui->rects[i].atlas_idx] = 0;
+            num_rects++;
+        }
+    }
+    int    num_pages  = 0;
+    size_t pages_size = 0;
+    for (int i = 0; i < xarr_len(page_map); i++)
+    {
+        if (page_map[i] == 0)
+        {
+            page_map[i] = num_pages++;
+            pages_size += atlas_page_bytes(gui, gui->glyph_atlases[i].size_shift);
+        }
+    }
+
+    const size_t size = sizeof(atlas_cache_header) + gui->num_fonts * sizeof(uint64_t) +
+                        num_rects * sizeof(atlas_cache_rect) + num_pages * sizeof(uint32_t) + pages_size;
+    unsigned char* data = xmalloc(size);
+
+    const atlas_cache_header hdr = {
+        .magic          = ATLAS_CACHE_MAGIC,
+        .version        = ATLAS_CACHE_VERSION,
+        .rasterizer     = ATLAS_CACHE_RASTERIZER,
+        .glyph_mode     = gui->glyph_mode,
+        .atlas_channels = gui->atlas_channels,
+        .subpixel_bins  = gui->subpixel_bins,
+        .num_fonts      = gui->num_fonts,
+        .num_rects      = num_rects,
+        .num_pages      = num_pages,
+    };
+    memcpy(data, &hdr, sizeof(hdr));
+
+    uint64_t* font_hashes = (uint64_t*)(data + sizeof(hdr));
+    for (int i = 0; i < gui->num_fonts; i++)
+        font_hashes[i] = gui->fonts[i].hash;
+
+    atlas_cache_rect* rects = (atlas_cache_rect*)(font_hashes + gui->num_fonts);
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+    {
+        const atlas_rect* it = gui->rects + i;
+        if (it->atlas_idx >= 0)
+        {
+            *rects++ = (atlas_cache_rect){
+                .header       = it->header,
+                .x            = it->x,
+                .y            = it->y,
+                .w            = it->w,
+                .h            = it->h,
+                .pen_offset_x = it->pen_offset_x,
+                .pen_offset_y = it->pen_offset_y,
+                .atlas_idx    = page_map[it->atlas_idx],
+            };
+        }
+    }
+
+    // Pages are written in page_map order
+    uint32_t*      page_sizes = (uint32_t*)rects;
+    unsigned char* pages      = (unsigned char*)(page_sizes + num_pages);
+    for (int i = 0; i < xarr_len(page_map); i++)
+    {
+        if (page_map[i] < 0)
+            continue;
+        page_sizes[page_map[i]] = 1u << gui->glyph_atlases[i].size_shift;
+
+        const size_t         page_size = atlas_page_bytes(gui, gui->glyph_atlases[i].size_shift);
+        unsigned char*       dst       = pages;
+        const unsigned char* src       = atlas_page_pixels(gui, i);
+        xassert(src);
+        if (src)
+            memcpy(dst, src, page_size);
+        else
+            memset(dst, 0, page_size);
+        pages += page_size;
+    }
+    xarr_free(page_map);
+
+    // A read only location just means no cache next time
+    xfiles_write(gui->atlas_cache_path, data, size);
+    xfree(data);
+}
+
+TextLayer* text_layer_new(const text_layer_desc* desc)
 {
     TextLayer* gui = xcalloc(1, sizeof(*gui));
 
-    xarr_setcap(gui->rects, 64);
-    gui->text_sbo = sg_make_buffer(&(sg_buffer_desc){
-        .usage.storage_buffer = true,
-        .usage.stream_update  = true,
-        .size                 = sizeof(gui->text_buffer),
-        .label                = "text SBO",
-    });
-    xassert(gui->text_sbo.id);
-    gui->text_sbv = sg_make_view(&(sg_view_desc){
-        .storage_buffer = gui->text_sbo,
-    });
-    xassert(gui->text_sbv.id);
+    gui->glyph_mode                    = desc->glyph_mode;
+    gui->max_atlas_pages               = desc->max_atlas_pages;
+    gui->atlas_texture_array           = desc->atlas_texture_array;
+    gui->atlas_compact_threshold       = desc->atlas_compact_threshold;
+    gui->update_image_region           = desc->update_image_region;
+    gui->update_image_region_user_data = desc->update_image_region_user_data;
+
+    gui->atlas_channels     = PLATFORM_TEXTURE_CHANNELS;
+    gui->atlas_pixel_format = PLATFORM_SG_PIXEL_FORMAT;
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+    {
+        gui->atlas_channels     = 4;
+        gui->atlas_pixel_format = SG_PIXELFORMAT_RGBA8;
+    }
+
+    const int max_atlas_size = desc->max_atlas_page_size > 0 ? desc->max_atlas_page_size : ATLAS_DEFAULT_MAX_SIZE;
+    xassert(max_atlas_size >= ATLAS_MIN_SIZE && max_atlas_size <= TEXT_LAYER_MAX_ATLAS_PAGE_SIZE);
+    xassert((max_atlas_size & (max_atlas_size - 1)) == 0);
+    gui->max_atlas_size_shift = ATLAS_MIN_SIZE_SHIFT;
+    while ((1 << gui->max_atlas_size_shift) < max_atlas_size)
+        gui->max_atlas_size_shift++;
+    if (desc->large_glyph_size >= 0)
+        gui->large_glyph_size = desc->large_glyph_size > 0 ? desc->large_glyph_size : ATLAS_DEFAULT_LARGE_GLYPH_SIZE;
 
+    gui->backing_scale = desc->backing_scale > 0 ? desc->backing_scale : PLATFORM_BACKING_SCALE_FACTOR;
+
+    gui->subpixel_bins = desc->subpixel_bins > 0 ? desc->subpixel_bins : 1;
+    xassert(gui->subpixel_bins <= TEXT_LAYER_MAX_SUBPIXEL_BINS);
+    xassert((gui->subpixel_bins & (gui->subpixel_bins - 1)) == 0);
+    while ((1 << gui->subpixel_shift) < gui->subpixel_bins)
+        gui->subpixel_shift++;
+
+    xarr_setcap(gui->rects, 64);
+    glyph_map_reserve(&gui->rect_map, 64);
+    gui->max_glyphs          = desc->max_glyphs;
+    gui->disable_shape_cache = desc->disable_shape_cache;
+    xarr_setcap(gui->text_buffer, TEXT_BUFFER_INITIAL_CAP);
+    make_text_sbo(gui, TEXT_BUFFER_INITIAL_CAP);
+
+#if defined(SOKOL_DUMMY_BACKEND)
+    // sokol-shdc has no output for the dummy backend. Borrow the GLSL shader's reflection info, the dummy backend
+    // ignores the code itself
+    sg_backend shd_backend = SG_BACKEND_GLCORE;
+#else
+    sg_backend shd_backend = sg_query_backend();
+#endif
 #if defined(RASTER_FREETYPE_MULTICHANNEL)
-    sg_shader shd = sg_make_shader(text_multichannel_shader_desc(sg_query_backend()));
+    // Distance fields need a single channel atlas
+    xassert(gui->glyph_mode == TEXT_LAYER_GLYPH_BITMAP);
+    sg_shader shd = sg_make_shader(
+        gui->atlas_texture_array ? text_multichannel_array_shader_desc(shd_backend)
+                                 : text_multichannel_shader_desc(shd_backend));
 #else
-    sg_shader shd = sg_make_shader(text_singlechannel_shader_desc(sg_query_backend()));
+    const sg_shader_desc* shd_desc = text_singlechannel_shader_desc(shd_backend);
+    if (gui->glyph_mode == TEXT_LAYER_GLYPH_SDF)
+        shd_desc = text_sdf_shader_desc(shd_backend);
+    else if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+        shd_desc = text_msdf_shader_desc(shd_backend);
+    if (gui->atlas_texture_array)
+    {
+        shd_desc = text_singlechannel_array_shader_desc(shd_backend);
+        if (gui->glyph_mode == TEXT_LAYER_GLYPH_SDF)
+            shd_desc = text_sdf_array_shader_desc(shd_backend);
+        else if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+            shd_desc = text_msdf_array_shader_desc(shd_backend);
+    }
+    sg_shader shd = sg_make_shader(shd_desc);
 #endif
 
     sg_pipeline_desc pip_desc = {.shader = shd, .label = "img-pipeline"};
@@ -510,179 +3045,917 @@ TextLayer* text_layer_new(const char* font_path)
 #endif
 
     gui->text_pip      = sg_make_pipeline(&pip_desc);
-    bool did_read_file = xfiles_read(font_path, &gui->fontdata, &gui->fontdata_size);
-    xassert(did_read_file);
-    if (did_read_file)
-    {
+    if (gui->glyph_mode != TEXT_LAYER_GLYPH_BITMAP)
+        gui->text_smp = sg_make_sampler(&(sg_sampler_desc){
+            .min_filter = SG_FILTER_LINEAR,
+            .mag_filter = SG_FILTER_LINEAR,
+            .wrap_u     = SG_WRAP_CLAMP_TO_EDGE,
+            .wrap_v     = SG_WRAP_CLAMP_TO_EDGE,
+            .label      = "text distance field sampler",
+        });
+
 #ifdef RASTER_FREETYPE
-        int err = FT_Init_FreeType(&gui->ft_lib);
-        xassert(!err);
-        err = FT_New_Memory_Face(gui->ft_lib, gui->fontdata, gui->fontdata_size, 0, &gui->ft_face);
-        xassert(!err);
+    gui->ft_render_mode = gui->glyph_mode == TEXT_LAYER_GLYPH_SDF ? FT_RENDER_MODE_SDF : PLATFORM_FT_RENDER_MODE;
+    open_ft_library(gui, &gui->ft_lib);
+
+    gui->max_rasters_per_frame = desc->max_rasters_per_frame;
+    if (desc->num_raster_threads > 0)
+    {
+        xmutex_init(&gui->raster_lock);
+        xcond_init(&gui->raster_wake);
+
+        // Workers hold pointers into this array, so it must never be resized while they run
+        xarr_setlen(gui->raster_workers, desc->num_raster_threads);
+        for (int i = 0; i < desc->num_raster_threads; i++)
+        {
+            raster_worker* worker = gui->raster_workers + i;
+            memset(worker, 0, sizeof(*worker));
+            worker->gui = gui;
+
+            open_ft_library(gui, &worker->ft_lib);
+            bool started = xthread_create(&worker->thread, raster_worker_run, worker);
+            xassert(started);
+        }
+    }
 #endif // RASTER_FREETYPE
-#ifdef RASTER_STB_TRUETYPE
-        int offset = stbtt_GetFontOffsetForIndex(gui->fontdata, 0);
-        xassert(offset != -1);
-        if (offset != -1)
+
+    xarr_setcap(gui->glyph_atlases, 16);
+    for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+        atlas_packer_init(
+            &gui->current_atlases[i].packer,
+            i == ATLAS_CLASS_LARGE ? desc->large_glyph_packer : desc->packer);
+    start_atlas_pages(gui);
+
+    // Fonts are pushed for the duration of each shape_text() call
+    gui->kb_context = kbts_CreateShapeContext(0, 0);
+
+    if (desc->atlas_cache_path)
+    {
+        const size_t path_len = strlen(desc->atlas_cache_path);
+        gui->atlas_cache_path = xmalloc(path_len + 1);
+        memcpy(gui->atlas_cache_path, desc->atlas_cache_path, path_len + 1);
+        load_atlas_cache(gui);
+    }
+
+    text_layer_add_font(gui, desc->font_path);
+
+    return gui;
+}
+
+// Maps a font file read only. Every instance using the font shares the OS page cache instead of holding its own heap
+// copy, and only the tables that are actually read get paged in
+bool map_font_file(const char* path, shared_font* font)
+{
+    void*  data = NULL;
+    size_t size = 0;
+#ifdef _WIN32
+    wchar_t wpath[MAX_PATH];
+    if (!MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, ARRLEN(wpath)))
+        return false;
+
+    HANDLE file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+
+    // Mapping an empty file fails
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping)
         {
-            int ok = stbtt_InitFont(&gui->fontinfo, gui->fontdata, offset);
-            xassert(ok != 0);
+            data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            size = file_size.QuadPart;
+            // The view keeps the mapping alive
+            CloseHandle(mapping);
         }
+    }
+    CloseHandle(file);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+    {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        size = st.st_size;
+        if (data == MAP_FAILED)
+            data = NULL;
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
 #endif
+    if (!data)
+        return false;
 
-        gui->current_atlas.idx = 0;
-        xarr_setcap(gui->glyph_atlases, 16);
-        xarr_setlen(gui->glyph_atlases, 1);
-        gui->glyph_atlases[0] = glyph_atlas_new();
+    font->fontdata        = data;
+    font->fontdata_size   = size;
+    font->fontdata_mapped = true;
+    return true;
+}
+
+void free_font_file(shared_font* font)
+{
+    if (font->fontdata_mapped)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(font->fontdata);
+#else
+        munmap(font->fontdata, font->fontdata_size);
+#endif
+    }
+    else
+    {
+        XFILES_FREE(font->fontdata);
+    }
+    font->fontdata      = NULL;
+    font->fontdata_size = 0;
+}
 
-        xarr_setlen(gui->current_atlas.nodes, (ATLAS_WIDTH * 2));
-        gui->current_atlas.img_data = xcalloc(1, ATLAS_HEIGHT * ATLAS_ROW_STRIDE);
-        stbrp_init_target(
-            &gui->current_atlas.ctx,
-            ATLAS_WIDTH,
-            ATLAS_HEIGHT,
-            gui->current_atlas.nodes,
-            xarr_len(gui->current_atlas.nodes));
+// Identifies a font file by its contents. The whole file is hashed, because font tools don't always update the table
+// checksums. Runs once per font per process, as fonts are shared between layers
+uint64_t hash_font_data(const void* data, size_t size)
+{
+    const unsigned char* bytes = data;
 
-        // Open a font file
-        gui->kb_context = kbts_CreateShapeContext(0, 0);
-        kbts_ShapePushFontFromMemory(gui->kb_context, gui->fontdata, gui->fontdata_size, 0);
+    // Four independent lanes of 8 bytes each, so the multiplies of one don't wait on the others
+    uint64_t lanes[4] = {size, 1, 2, 3};
+    size_t   i        = 0;
+    for (; i + sizeof(lanes) <= size; i += sizeof(lanes))
+    {
+        uint64_t words[4];
+        memcpy(words, bytes + i, sizeof(words));
+        for (int l = 0; l < 4; l++)
+            lanes[l] = glyph_map_hash(lanes[l] ^ words[l]);
     }
+    uint64_t tail[4] = {0};
+    memcpy(tail, bytes + i, size - i);
 
-    return gui;
+    uint64_t hash = 0;
+    for (int l = 0; l < 4; l++)
+        hash = glyph_map_hash(hash ^ lanes[l] ^ tail[l]);
+    return hash;
+}
+
+// Loads a font into the registry, or references it if another TextLayer already has. Returns the registry id, or -1
+int acquire_shared_font(const char* font_path)
+{
+    int id = -1;
+
+    xmutex_lock(&g_text_shared.lock);
+    for (int i = 0; i < SHARED_MAX_FONTS && id == -1; i++)
+        if (g_text_shared.fonts[i].path && strcmp(g_text_shared.fonts[i].path, font_path) == 0)
+            id = i;
+
+    if (id != -1)
+    {
+        g_text_shared.fonts[id].refcount++;
+    }
+    else
+    {
+        for (int i = 0; i < SHARED_MAX_FONTS && id == -1; i++)
+            if (g_text_shared.fonts[i].path == NULL)
+                id = i;
+        xassert(id != -1);
+
+        shared_font* font = id != -1 ? g_text_shared.fonts + id : NULL;
+        // Read the whole file into the heap where mapping isn't possible
+        bool did_read_file = font && (map_font_file(font_path, font) ||
+                                      xfiles_read(font_path, &font->fontdata, &font->fontdata_size));
+        xassert(did_read_file);
+        if (did_read_file)
+        {
+            font->hash    = hash_font_data(font->fontdata, font->fontdata_size);
+            font->kb_font = kbts_FontFromMemory(font->fontdata, font->fontdata_size, 0, 0, 0);
+            xassert(kbts_FontIsValid(&font->kb_font));
+
+            const size_t path_len = strlen(font_path);
+            font->path            = xmalloc(path_len + 1);
+            memcpy(font->path, font_path, path_len + 1);
+            font->refcount = 1;
+            g_text_shared.num_fonts++;
+        }
+        else
+        {
+            id = -1;
+        }
+    }
+    xmutex_unlock(&g_text_shared.lock);
+
+    return id;
+}
+
+// Drops a reference to a registry font. The last TextLayer to let go of a font frees it and its glyphs, and the last
+// to let go of every font frees the glyph cache
+void release_shared_font(int id)
+{
+    xmutex_lock(&g_text_shared.lock);
+    shared_font* font = g_text_shared.fonts + id;
+    xassert(font->refcount > 0);
+    if (--font->refcount == 0)
+    {
+        kbts_FreeFont(&font->kb_font);
+        free_font_file(font);
+        xfree(font->path);
+        memset(font, 0, sizeof(*font));
+        purge_shared_glyphs(id);
+
+        if (--g_text_shared.num_fonts == 0)
+        {
+            xarr_free(g_text_shared.glyphs);
+            g_text_shared.glyphs      = NULL;
+            g_text_shared.glyph_bytes = 0;
+            for (int i = 0; i < ARRLEN(g_text_shared.glyph_maps); i++)
+                glyph_map_free(&g_text_shared.glyph_maps[i]);
+        }
+    }
+    xmutex_unlock(&g_text_shared.lock);
 }
 
 void text_layer_destroy(TextLayer* gui)
 {
-    xfree(gui->current_atlas.img_data);
-    xarr_free(gui->current_atlas.nodes);
+#ifdef RASTER_FREETYPE
+    if (xarr_len(gui->raster_workers))
+    {
+        xmutex_lock(&gui->raster_lock);
+        gui->raster_quit = true;
+        xmutex_unlock(&gui->raster_lock);
+        xcond_broadcast(&gui->raster_wake);
+
+        for (int i = 0; i < xarr_len(gui->raster_workers); i++)
+        {
+            raster_worker* worker = gui->raster_workers + i;
+            xthread_join(worker->thread);
+            for (int j = 0; j < ARRLEN(worker->ft_faces); j++)
+                if (worker->ft_faces[j])
+                    FT_Done_Face(worker->ft_faces[j]);
+            FT_Done_FreeType(worker->ft_lib);
+        }
+        xcond_destroy(&gui->raster_wake);
+        xmutex_destroy(&gui->raster_lock);
+    }
+    for (int i = 0; i < xarr_len(gui->raster_results); i++)
+        if (gui->raster_results[i].bitmap)
+            xfree(gui->raster_results[i].bitmap);
+    for (int i = 0; i < xarr_len(gui->raster_ready); i++)
+        if (gui->raster_ready[i].bitmap)
+            xfree(gui->raster_ready[i].bitmap);
+    xarr_free(gui->raster_workers);
+    xarr_free(gui->raster_queue);
+    xarr_free(gui->raster_results);
+    xarr_free(gui->raster_ready);
+    glyph_map_free(&gui->raster_requested);
+#endif // RASTER_FREETYPE
+
+    if (gui->atlas_cache_path)
+    {
+        save_atlas_cache(gui);
+        xfree(gui->atlas_cache_path);
+    }
+    xarr_free(gui->cache_font_hashes);
+    xarr_free(gui->pending_cache_rects);
+    destroy_retired_pages(gui);
+    for (int i = 0; i < xarr_len(gui->glyph_atlases); i++)
+    {
+        // Texture array layers share atlas_array's image
+        if (!gui->atlas_texture_array)
+        {
+            sg_image img = sg_query_view_desc(gui->glyph_atlases[i].img_view).texture.image;
+            sg_destroy_view(gui->glyph_atlases[i].img_view);
+            sg_destroy_image(img);
+        }
+        if (gui->glyph_atlases[i].pixels)
+            xfree(gui->glyph_atlases[i].pixels);
+    }
+
+    if (gui->atlas_texture_array)
+    {
+        sg_destroy_view(gui->atlas_array.view);
+        sg_destroy_image(gui->atlas_array.img);
+        xfree(gui->atlas_array.pixels);
+        xarr_free(gui->atlas_array.dirty_regions);
+    }
+    for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+    {
+        if (!gui->atlas_texture_array && gui->current_atlases[i].img_data)
+            xfree(gui->current_atlases[i].img_data);
+        atlas_packer_free(&gui->current_atlases[i].packer);
+    }
     xarr_free(gui->rects);
+    xarr_free(gui->free_rects);
+    glyph_map_free(&gui->rect_map);
     xarr_free(gui->glyph_atlases);
+    xarr_free(gui->atlas_quad_offsets);
+    xarr_free(gui->retired_page_views);
+    if (gui->text_smp.id)
+        sg_destroy_sampler(gui->text_smp);
+    sg_destroy_view(gui->text_sbv);
+    sg_destroy_buffer(gui->text_sbo);
+    sg_shader shd = sg_query_pipeline_desc(gui->text_pip).shader;
+    sg_destroy_pipeline(gui->text_pip);
+    sg_destroy_shader(shd);
+    xarr_free(gui->text_buffer);
+    xarr_free(gui->text_buffer_sorted);
+
+    for (int i = 0; i < gui->num_fonts; i++)
+    {
+        text_font* font = gui->fonts + i;
+#ifdef RASTER_FREETYPE
+        int error = FT_Done_Face(font->ft_face);
+        xassert(!error);
+#endif
+        release_shared_font(font->shared_id);
+    }
 
 #ifdef RASTER_FREETYPE
-    int error = FT_Done_Face(gui->ft_face);
-    xassert(!error);
-    error = FT_Done_FreeType(gui->ft_lib);
+    int error = FT_Done_FreeType(gui->ft_lib);
     xassert(!error);
 #endif // RASTER_FREETYPE
 
     kbts_DestroyShapeContext(gui->kb_context);
 
-    XFILES_FREE(gui->fontdata);
+    for (int i = 0; i < xarr_len(gui->shape_cache); i++)
+        shaped_run_free(gui->shape_cache + i);
+    xarr_free(gui->shape_cache);
+    glyph_map_free(&gui->shape_cache_map);
+    xarr_free(gui->shape_scratch.glyphs);
+    xarr_free(gui->shared_bitmap);
+    xarr_free(gui->coverage_masks);
+    glyph_map_free(&gui->coverage_map);
 
     xfree(gui);
 }
 
-void text_layer_prerender_ascii(TextLayer* gui, float font_size)
+text_layer_font text_layer_add_font(TextLayer* gui, const char* font_path)
 {
-    // Pre-render standard latin
-    // from "!" to "~" https://www.ascii-code.com/
-    for (int codepoint = 33; codepoint < 127; codepoint++)
-    {
-#if defined(RASTER_FREETYPE)
-        FT_UInt glyph_index = FT_Get_Char_Index(gui->ft_face, codepoint);
-#elif defined(RASTER_STB_TRUETYPE)
-        uint32_t glyph_index = stbtt_FindGlyphIndex(&gui->fontinfo, codepoint);
+    xassert(gui->num_fonts < TEXT_LAYER_MAX_FONTS);
+    if (gui->num_fonts == TEXT_LAYER_MAX_FONTS)
+        return (text_layer_font){0};
+
+    text_font* font = gui->fonts + gui->num_fonts;
+    font->shared_id = acquire_shared_font(font_path);
+    if (font->shared_id == -1)
+        return (text_layer_font){0};
+
+    const shared_font* shared = g_text_shared.fonts + font->shared_id;
+    font->fontdata            = shared->fontdata;
+    font->fontdata_size       = shared->fontdata_size;
+    font->hash                = shared->hash;
+    font->kb_font             = shared->kb_font;
+
+#ifdef RASTER_FREETYPE
+    open_ft_face(gui->ft_lib, font, &font->ft_face);
 #endif
-        raster_glyph(gui, glyph_index, font_size);
+#ifdef RASTER_STB_TRUETYPE
+    int offset = stbtt_GetFontOffsetForIndex(font->fontdata, 0);
+    xassert(offset != -1);
+    if (offset != -1)
+    {
+        int ok = stbtt_InitFont(&font->fontinfo, font->fontdata, offset);
+        xassert(ok != 0);
     }
+#endif
+
+    add_cached_rects(gui, gui->num_fonts);
+
+    return (text_layer_font){gui->num_fonts++};
 }
 
-void text_layer_draw_text(TextLayer* gui, const char* text_start, const char* text_end, int x, int y, float font_size)
+void text_layer_add_fallback_font(TextLayer* gui, text_layer_font font)
 {
-    if (text_end == NULL)
-        text_end = text_start + strlen(text_start);
-    kbts_ShapeBegin(gui->kb_context, KBTS_DIRECTION_DONT_KNOW, KBTS_LANGUAGE_DONT_KNOW);
-    kbts_ShapeUtf8(gui->kb_context, text_start, text_end - text_start, KBTS_USER_ID_GENERATION_MODE_CODEPOINT_INDEX);
-    kbts_ShapeEnd(gui->kb_context);
+    xassert(font.id < gui->num_fonts);
+    xassert(gui->num_fallback_fonts < TEXT_LAYER_MAX_FONTS);
+    if (font.id < gui->num_fonts && gui->num_fallback_fonts < TEXT_LAYER_MAX_FONTS)
+        gui->fallback_fonts[gui->num_fallback_fonts++] = font.id;
+
+    // Runs shaped before the change may have missing glyphs
+    for (int i = 0; i < xarr_len(gui->shape_cache); i++)
+        shaped_run_free(gui->shape_cache + i);
+    xarr_setlen(gui->shape_cache, 0);
+    glyph_map_clear(&gui->shape_cache_map);
+}
 
-#if defined(RASTER_FREETYPE)
-    const FT_Size_Metrics* FtSizeMetrics  = &gui->ft_face->size->metrics;
-    int                    x_scale        = FtSizeMetrics->x_scale;
-    int                    y_scale        = FtSizeMetrics->y_scale;
-    x_scale                              /= PLATFORM_BACKING_SCALE_FACTOR;
-    y_scale                              /= PLATFORM_BACKING_SCALE_FACTOR;
+void text_layer_set_backing_scale(TextLayer* gui, float backing_scale)
+{
+    xassert(backing_scale > 0);
+    if (backing_scale > 0)
+        gui->backing_scale = backing_scale;
+}
+
+void text_layer_prerender(
+    TextLayer*                        gui,
+    text_layer_font                   font,
+    const text_layer_codepoint_range* ranges,
+    int                               num_ranges,
+    const float*                      font_sizes,
+    int                               num_sizes)
+{
+    xassert(font.id < gui->num_fonts);
+    const text_font* tf = gui->fonts + font.id;
 
-    int max_font_height_pixels = (gui->ft_face->size->metrics.ascender - gui->ft_face->size->metrics.descender) >> 6;
-    int pen_y_offset           = max_font_height_pixels + (gui->ft_face->size->metrics.descender >> 6);
+    uint64_t raster_start = xtime_now_ns();
+
+    // Raster every missing glyph to its own bitmap first, so they can all be packed at once
+    raster_job* jobs  = NULL;
+    glyph_map   batch = {0}; // Codepoints can share a glyph
+    const int   bins  = gui->glyph_mode == TEXT_LAYER_GLYPH_BITMAP ? gui->subpixel_bins : 1;
+    for (int s = 0; s < num_sizes; s++)
+    {
+        const float pixel_size =
+            gui->glyph_mode == TEXT_LAYER_GLYPH_BITMAP ? font_sizes[s] * gui->backing_scale : SDF_REFERENCE_SIZE;
+
+        for (int r = 0; r < num_ranges; r++)
+        {
+            for (uint32_t codepoint = ranges[r].first; codepoint <= ranges[r].last; codepoint++)
+            {
+#if defined(RASTER_FREETYPE)
+                const uint32_t glyph_index = FT_Get_Char_Index(tf->ft_face, codepoint);
+#elif defined(RASTER_STB_TRUETYPE)
+                const uint32_t glyph_index = stbtt_FindGlyphIndex(&tf->fontinfo, codepoint);
 #endif
-#if defined(RASTER_STB_TRUETYPE)
-    int ascent = 0, descent = 0, lineGap = 0;
-    stbtt_GetFontVMetrics(&gui->fontinfo, &ascent, &descent, &lineGap);
+                if (glyph_index == 0)
+                    continue;
 
-    int max_font_height_pixels = (ascent + descent) >> 6;
-    int pen_y_offset           = max_font_height_pixels + (descent >> 6);
+                for (int bin = 0; bin < bins; bin++)
+                {
+                    raster_job job = {
+                        .header = {
+                            .glyphid      = glyph_index,
+                            .subpixel_bin = bin,
+                            .font_id      = font.id,
+                            .pixel_size   = pixel_size,
+                        }};
+                    if (glyph_map_get(&gui->rect_map, job.header.data) >= 0 ||
+                        glyph_map_get(&batch, job.header.data) >= 0)
+                        continue;
+                    glyph_map_set(&batch, job.header.data, 0);
+
+                    if (pack_shared_glyph(gui, job.header))
+                    {
+                        gui->counters.shared_glyph_hits++;
+                        continue;
+                    }
 
-    // TODO: figure out hwo to scale with STB_TRUETYPE
-    int x_scale = 32768;
-    int y_scale = 32768;
+#if defined(RASTER_FREETYPE)
+                    render_raster_job(gui, tf->ft_face, &job);
+#elif defined(RASTER_STB_TRUETYPE)
+                    render_raster_job(gui, &job);
 #endif
+                    if (job.bitmap)
+                        xarr_push(jobs, job);
+                }
+            }
+        }
+    }
+    glyph_map_free(&batch);
 
-    // Layout runs naively left to right.
-    kbts_run Run;
-    int      CursorX = 0, CursorY = 0;
-    while (kbts_ShapeRun(gui->kb_context, &Run))
+    // atlas_packer_pack() packs the tallest rects first, which wastes less space than packing them in codepoint order.
+    // Each size class is packed into its own pages. Whatever doesn't fit goes to the next page of the class
+    stbrp_rect* rects = NULL;
+    for (int size_class = 0; size_class < ATLAS_NUM_CLASSES; size_class++)
     {
-        kbts_glyph* Glyph;
-        while (kbts_GlyphIteratorNext(&Run.Glyphs, &Glyph))
+        xarr_setlen(rects, 0);
+        for (int i = 0; i < xarr_len(jobs); i++)
+        {
+            stbrp_rect rect = {.id = i, .w = jobs[i].width + RECTPACK_PADDING, .h = jobs[i].rows + RECTPACK_PADDING};
+            if (glyph_size_class(gui, rect.w, rect.h) == size_class)
+                xarr_push(rects, rect);
+        }
+
+        int num_left = xarr_len(rects);
+        while (num_left > 0)
+        {
+            atlas_packer_pack(&use_current_atlas(gui, size_class)->packer, rects, num_left);
+
+            int num_unpacked = 0;
+            for (int i = 0; i < num_left; i++)
+            {
+                if (!rects[i].was_packed)
+                {
+                    rects[num_unpacked++] = rects[i];
+                    continue;
+                }
+
+                const raster_job* job = jobs + rects[i].id;
+                place_glyph_bitmap(
+                    gui,
+                    size_class,
+                    job->header,
+                    rects + i,
+                    job->bitmap,
+                    job->width * job->channels,
+                    job->width,
+                    job->rows,
+                    job->channels,
+                    job->bitmap_left,
+                    job->bitmap_top);
+                publish_shared_glyph(gui, job->header);
+                gui->counters.glyphs_rasterized++;
+            }
+
+            if (num_unpacked == 0)
+                break;
+
+            // Glyphs too big for any page are dropped
+            if (!make_atlas_room(gui, size_class))
+                break;
+            num_left = num_unpacked;
+        }
+    }
+
+    for (int i = 0; i < xarr_len(jobs); i++)
+        xfree(jobs[i].bitmap);
+    xarr_free(jobs);
+    xarr_free(rects);
+
+    gui->counters.raster_time += xtime_now_ns() - raster_start;
+}
+
+text_layer_compact_result text_layer_compact_atlases(TextLayer* gui)
+{
+    text_layer_compact_result result = {0};
+    text_layer_stats          stats;
+    text_layer_get_stats(gui, &stats);
+    result.pages_before = result.pages_after = stats.atlas_pages;
+    result.bytes_before = result.bytes_after = stats.atlas_bytes;
+
+    // Queued quads sample the pages about to be replaced
+    xassert(xarr_len(gui->text_buffer) == 0);
+    if (xarr_len(gui->text_buffer))
+        return result;
+
+    // Glyphs to move, by size class. Ids past num_rects are glyphs loaded from the cache file whose font hasn't been
+    // added yet
+    const int   num_rects                = xarr_len(gui->rects);
+    stbrp_rect* packs[ATLAS_NUM_CLASSES] = {0};
+    for (int i = 0; i < num_rects; i++)
+    {
+        const atlas_rect* it = gui->rects + i;
+        if (it->atlas_idx < 0)
+            continue;
+        if (gui->frame - it->last_used_frame > ATLAS_COMPACT_MAX_AGE)
+        {
+            evict_atlas_rect(gui, i);
+            result.glyphs_dropped++;
+            continue;
+        }
+        stbrp_rect pack = {.id = i, .w = it->w + RECTPACK_PADDING, .h = it->h + RECTPACK_PADDING};
+        xarr_push(packs[glyph_size_class(gui, pack.w, pack.h)], pack);
+    }
+    for (int i = 0; i < xarr_len(gui->pending_cache_rects); i++)
+    {
+        const atlas_cache_rect* it = gui->pending_cache_rects + i;
+        stbrp_rect pack = {.id = num_rects + i, .w = it->w + RECTPACK_PADDING, .h = it->h + RECTPACK_PADDING};
+        xarr_push(packs[glyph_size_class(gui, pack.w, pack.h)], pack);
+    }
+
+    // Glyphs are copied out of the old pages, so they're kept until every glyph is placed. Current pages hand their
+    // pixels over to their old page
+    glyph_atlas*   old_pages       = gui->glyph_atlases;
+    unsigned char* old_array       = gui->atlas_array.pixels;
+    sg_image       old_array_img   = gui->atlas_array.img;
+    sg_view        old_array_view  = gui->atlas_array.view;
+    const size_t   old_layer_bytes = atlas_page_bytes(gui, gui->max_atlas_size_shift);
+    for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+    {
+        current_atlas* cur = gui->current_atlases + i;
+        if (!old_array && cur->idx >= 0)
+        {
+            if (old_pages[cur->idx].pixels)
+                xfree(old_pages[cur->idx].pixels);
+            old_pages[cur->idx].pixels = cur->img_data;
+        }
+        cur->img_data = NULL;
+    }
+
+    gui->glyph_atlases = NULL;
+    xarr_free(gui->atlas_array.dirty_regions);
+    memset(&gui->atlas_array, 0, sizeof(gui->atlas_array));
+    xarr_setcap(gui->glyph_atlases, 16);
+    start_atlas_pages(gui);
+
+    for (int size_class = 0; size_class < ATLAS_NUM_CLASSES; size_class++)
+    {
+        stbrp_rect* class_packs = packs[size_class];
+        int         num_left    = xarr_len(class_packs);
+        while (num_left > 0)
         {
-            int GlyphX = CursorX + Glyph->OffsetX;
-            int GlyphY = CursorY + Glyph->OffsetY;
+            current_atlas* cur = use_current_atlas(gui, size_class);
+            atlas_packer_pack(&cur->packer, class_packs, num_left);
+
+            int num_unpacked = 0;
+            for (int i = 0; i < num_left; i++)
+            {
+                const stbrp_rect* pack = class_packs + i;
+                if (!pack->was_packed)
+                {
+                    class_packs[num_unpacked++] = *pack;
+                    continue;
+                }
 
-            int glyph_x = ((GlyphX >> 6) * x_scale) >> 16;
-            int glyph_y = ((GlyphY >> 6) * y_scale) >> 16;
-            draw_glyph(gui, x + glyph_x, y + glyph_y + pen_y_offset, Glyph->Id, font_size);
+                atlas_rect*       rect    = pack->id < num_rects ? gui->rects + pack->id : NULL;
+                atlas_cache_rect* pending = rect ? NULL : gui->pending_cache_rects + pack->id - num_rects;
+                int16_t*          x       = rect ? &rect->x : &pending->x;
+                int16_t*          y       = rect ? &rect->y : &pending->y;
+                int16_t*          page    = rect ? &rect->atlas_idx : &pending->atlas_idx;
+                const int         w       = rect ? rect->w : pending->w;
+                const int         h       = rect ? rect->h : pending->h;
+
+                const unsigned char* src_pixels =
+                    old_array ? old_array + *page * old_layer_bytes : old_pages[*page].pixels;
+                xassert(src_pixels);
+                const int            src_stride = (1 << old_pages[*page].size_shift) * gui->atlas_channels;
+                const unsigned char* src        = src_pixels + *y * src_stride + *x * gui->atlas_channels;
+
+                *x    = pack->x + RECTPACK_PADDING;
+                *y    = pack->y + RECTPACK_PADDING;
+                *page = cur->idx;
+                if (rect)
+                    rect->img_view = gui->glyph_atlases[cur->idx].img_view;
+
+                unsigned char* dst = cur->img_data + *y * cur->row_stride + *x * gui->atlas_channels;
+                for (int row = 0; row < h; row++)
+                    memcpy(dst + row * cur->row_stride, src + row * src_stride, w * gui->atlas_channels);
+                mark_current_atlas_dirty(gui, cur, *x, *y, w, h);
+                cur->empty = false;
+                result.glyphs_moved++;
+            }
+
+            // Every glyph fit a page before, so this always makes room
+            const bool made_room = num_unpacked == 0 || make_atlas_room(gui, size_class);
+            xassert(made_room);
+            if (num_unpacked == 0 || !made_room)
+                break;
+            num_left = num_unpacked;
+        }
+        xarr_free(packs[size_class]);
+    }
 
-            CursorX += Glyph->AdvanceX;
-            CursorY += Glyph->AdvanceY;
+    for (int i = 0; i < xarr_len(old_pages); i++)
+    {
+        if (!old_array)
+        {
+            sg_image img = sg_query_view_desc(old_pages[i].img_view).texture.image;
+            sg_destroy_view(old_pages[i].img_view);
+            sg_destroy_image(img);
         }
+        if (old_pages[i].pixels)
+            xfree(old_pages[i].pixels);
+    }
+    xarr_free(old_pages);
+    if (old_array)
+    {
+        sg_destroy_view(old_array_view);
+        sg_destroy_image(old_array_img);
+        xfree(old_array);
     }
+
+    gui->counters.atlas_compactions++;
+    text_layer_get_stats(gui, &stats);
+    result.pages_after = stats.atlas_pages;
+    result.bytes_after = stats.atlas_bytes;
+    return result;
+}
+
+// True when the glyphs drawn recently fill less than atlas_compact_threshold of the pages
+bool should_compact_atlases(TextLayer* gui)
+{
+    if (xarr_len(gui->glyph_atlases) < 2)
+        return false;
+
+    uint64_t live_area = 0;
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+    {
+        const atlas_rect* it = gui->rects + i;
+        if (it->atlas_idx >= 0 && gui->frame - it->last_used_frame <= ATLAS_COMPACT_MAX_AGE)
+            live_area += (it->w + RECTPACK_PADDING) * (it->h + RECTPACK_PADDING);
+    }
+    uint64_t total_area = 0;
+    for (int i = 0; i < xarr_len(gui->glyph_atlases); i++)
+        total_area += 1llu << (gui->glyph_atlases[i].size_shift * 2);
+
+    return live_area < gui->atlas_compact_threshold * total_area;
+}
+
+void text_layer_draw_text(
+    TextLayer*      gui,
+    text_layer_font font,
+    const char*     text_start,
+    const char*     text_end,
+    int             x,
+    int             y,
+    float           font_size)
+{
+    xassert(font.id < gui->num_fonts);
+    const uint64_t draw_text_start = xtime_now_ns();
+    if (text_end == NULL)
+        text_end = text_start + strlen(text_start);
+    const int text_len = text_end - text_start;
+
+    const shaped_run* run = NULL;
+    if (gui->disable_shape_cache)
+    {
+        shaped_run scratch = {
+            .text      = (char*)text_start,
+            .text_len  = text_len,
+            .font_id   = font.id,
+            .font_size = font_size,
+            .direction = KBTS_DIRECTION_DONT_KNOW,
+            .language  = KBTS_LANGUAGE_DONT_KNOW,
+            .glyphs    = gui->shape_scratch.glyphs,
+        };
+        gui->shape_scratch = scratch;
+        shape_text(gui, &gui->shape_scratch);
+        run = &gui->shape_scratch;
+    }
+    else
+    {
+        run = get_shaped_run(gui, font.id, text_start, text_len, font_size);
+    }
+
+    const int num_glyphs = xarr_len(run->glyphs);
+    for (int i = 0; i < num_glyphs; i++)
+    {
+        const shaped_glyph* g = run->glyphs + i;
+        draw_glyph(gui, g->font_id, (x << 6) + g->x, y + g->y, g->id, font_size);
+    }
+    gui->counters.draw_text_time += xtime_now_ns() - draw_text_start;
 }
 
 void text_layer_draw(TextLayer* gui, sg_sampler sampler, int gui_width, int gui_height)
 {
-    if (gui->text_buffer_len)
+    const uint64_t draw_start = xtime_now_ns();
+
+#ifdef RASTER_FREETYPE
+    if (xarr_len(gui->raster_workers))
     {
-        glyph_atlas* atlas = gui->glyph_atlases + gui->current_atlas.idx;
-        if (atlas->dirty)
+        uint64_t raster_start = xtime_now_ns();
+        pack_raster_results(gui);
+        gui->counters.raster_time += xtime_now_ns() - raster_start;
+    }
+#endif
+
+    if (xarr_len(gui->text_buffer))
+    {
+        for (int i = 0; i < ATLAS_NUM_CLASSES; i++)
+            if (gui->current_atlases[i].idx >= 0)
+                upload_current_atlas(gui, gui->current_atlases + i);
+        upload_atlas_array(gui);
+
+        const int            num_atlases   = xarr_len(gui->glyph_atlases);
+        const int            num_quads     = xarr_len(gui->text_buffer);
+        const text_buffer_t* upload_buffer = gui->text_buffer;
+        int*                 offsets       = NULL;
+        // With a texture array each quad samples its own layer, so there's nothing to sort
+        if (!gui->atlas_texture_array)
+        {
+            // Bucket quads by atlas page with a counting sort so we can issue one draw per page.
+            // Order within a page is preserved
+            xarr_setlen(gui->atlas_quad_offsets, num_atlases + 1);
+            offsets = gui->atlas_quad_offsets;
+            memset(offsets, 0, sizeof(*offsets) * (num_atlases + 1));
+
+            for (int i = 0; i < num_quads; i++)
+                offsets[gui->text_buffer[i].page + 1]++;
+            for (int i = 0; i < num_atlases; i++)
+                offsets[i + 1] += offsets[i];
+
+            const int first_atlas = gui->text_buffer[0].page;
+            // Most frames only sample a single page, in which case text_buffer is already sorted
+            if (offsets[first_atlas + 1] - offsets[first_atlas] != num_quads)
+            {
+                xarr_setlen(gui->text_buffer_sorted, num_quads);
+                // Use the offsets as write cursors, then shift them back into place
+                for (int i = 0; i < num_quads; i++)
+                    gui->text_buffer_sorted[offsets[gui->text_buffer[i].page]++] = gui->text_buffer[i];
+                memmove(offsets + 1, offsets, sizeof(*offsets) * num_atlases);
+                offsets[0] = 0;
+
+                upload_buffer = gui->text_buffer_sorted;
+            }
+        }
+
+        if (num_quads > gui->text_sbo_cap)
         {
-            sg_view_desc view_desc = sg_query_view_desc(atlas->img_view);
-            sg_update_image(
-                view_desc.texture.image,
-                &(sg_image_data){
-                    .mip_levels[0] = {
-                        .ptr  = gui->current_atlas.img_data,
-                        .size = ATLAS_HEIGHT * ATLAS_ROW_STRIDE,
-                    }});
-            atlas->dirty = false;
+            int new_cap = gui->text_sbo_cap * 2;
+            while (new_cap < num_quads)
+                new_cap *= 2;
+            make_text_sbo(gui, new_cap);
         }
 
-        sg_range sbo_range = {.ptr = gui->text_buffer, .size = sizeof(gui->text_buffer[0]) * gui->text_buffer_len};
+        sg_range sbo_range = {.ptr = upload_buffer, .size = sizeof(gui->text_buffer[0]) * num_quads};
         sg_update_buffer(gui->text_sbo, &sbo_range);
+        gui->counters.buffer_bytes_uploaded += sbo_range.size;
 
         sg_apply_pipeline(gui->text_pip);
-
-        sg_bindings bind            = {0};
-        bind.views[VIEW_sb_text]    = gui->text_sbv;
-        bind.views[VIEW_text_tex]   = atlas->img_view;
-        bind.samplers[SMP_text_smp] = sampler; // nearest neighbour
-
-        sg_apply_bindings(&bind);
+        if (gui->text_smp.id)
+            sampler = gui->text_smp;
 
         vs_text_uniforms_t vs_text_uniforms = {
             .size = {gui_width, gui_height},
         };
         sg_apply_uniforms(UB_vs_text_uniforms, &SG_RANGE(vs_text_uniforms));
 
-        fs_text_singlechannel_t fs_text_singlechannel = {
-            .u_colour = {1, 1, 1, 1},
-        };
-        sg_apply_uniforms(UB_fs_text_singlechannel, &SG_RANGE(fs_text_singlechannel));
+        if (gui->glyph_mode == TEXT_LAYER_GLYPH_SDF)
+        {
+            fs_text_sdf_t fs_text_sdf = {
+                .u_colour = {1, 1, 1, 1},
+            };
+            sg_apply_uniforms(UB_fs_text_sdf, &SG_RANGE(fs_text_sdf));
+        }
+        else if (gui->glyph_mode == TEXT_LAYER_GLYPH_MSDF)
+        {
+            fs_text_msdf_t fs_text_msdf = {
+                .u_colour = {1, 1, 1, 1},
+            };
+            sg_apply_uniforms(UB_fs_text_msdf, &SG_RANGE(fs_text_msdf));
+        }
+        else
+        {
+            fs_text_singlechannel_t fs_text_singlechannel = {
+                .u_colour = {1, 1, 1, 1},
+            };
+            sg_apply_uniforms(UB_fs_text_singlechannel, &SG_RANGE(fs_text_singlechannel));
+        }
+
+        if (gui->atlas_texture_array)
+        {
+            sg_bindings bind                = {0};
+            bind.views[VIEW_sb_text]        = gui->text_sbv;
+            bind.views[VIEW_text_tex_array] = gui->atlas_array.view;
+            bind.samplers[SMP_text_smp]     = sampler;
+
+            sg_apply_bindings(&bind);
+
+            sg_draw(0, 6 * num_quads, 1);
+            gui->counters.draw_calls++;
+        }
+        else
+        {
+            for (int i = 0; i < num_atlases; i++)
+            {
+                const int first = offsets[i];
+                const int count = offsets[i + 1] - first;
+                if (count == 0)
+                    continue;
+
+                sg_bindings bind            = {0};
+                bind.views[VIEW_sb_text]    = gui->text_sbv;
+                bind.views[VIEW_text_tex]   = gui->glyph_atlases[i].img_view;
+                bind.samplers[SMP_text_smp] = sampler;
 
-        sg_draw(0, 6 * gui->text_buffer_len, 1);
+                sg_apply_bindings(&bind);
+
+                // The vertex shader derives the quad index from gl_VertexIndex, which includes the base element
+                sg_draw(6 * first, 6 * count, 1);
+                gui->counters.draw_calls++;
+            }
+        }
     }
 
-    gui->text_buffer_len = 0;
+    xarr_setlen(gui->text_buffer, 0);
+    destroy_retired_pages(gui);
+
+    if ((gui->frame & 31) == 0)
+        age_shape_cache(gui);
+    if (gui->atlas_compact_threshold > 0 && (gui->frame & 255) == 0 && should_compact_atlases(gui))
+        text_layer_compact_atlases(gui);
+
+    gui->counters.draw_time += xtime_now_ns() - draw_start;
+
+    // All counters are uint64_t
+    const uint64_t* frame_counters = (const uint64_t*)&gui->counters;
+    uint64_t*       total_counters = (uint64_t*)&gui->total_counters;
+    for (int i = 0; i < sizeof(gui->counters) / sizeof(uint64_t); i++)
+        total_counters[i] += frame_counters[i];
+    gui->last_frame_counters = gui->counters;
+    memset(&gui->counters, 0, sizeof(gui->counters));
+
+    gui->frame++;
+}
+
+void text_layer_get_stats(TextLayer* gui, text_layer_stats* stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->atlas_pages         = xarr_len(gui->glyph_atlases);
+    for (int i = 0; i < stats->atlas_pages; i++)
+    {
+        stats->atlas_bytes       += atlas_page_bytes(gui, gui->glyph_atlases[i].size_shift);
+        stats->large_glyph_pages += gui->glyph_atlases[i].size_class == ATLAS_CLASS_LARGE;
+    }
+    for (int i = 0; i < xarr_len(gui->rects); i++)
+    {
+        const atlas_rect* it = gui->rects + i;
+        if (it->atlas_idx >= 0)
+            stats->atlas_glyph_bytes += (it->w + RECTPACK_PADDING) * (it->h + RECTPACK_PADDING) * gui->atlas_channels;
+    }
+    if (gui->atlas_texture_array)
+        stats->atlas_bytes = gui->atlas_array.num_layers * atlas_page_bytes(gui, gui->max_atlas_size_shift);
+    stats->shape_cache_entries = xarr_len(gui->shape_cache);
+    stats->last_frame          = gui->last_frame_counters;
+    stats->total               = gui->total_counters;
 }
 
 #endif // TEXT_IMPL